@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+// Bump allocator for the directory walks. Allocations come out of a chain
+// of blocks and are never freed one by one: arena_mark() remembers where
+// the arena is, arena_release() drops everything allocated since, keeping
+// the blocks for what comes next. Blocks never move, pointers stay valid
+// until released.
+#define ARENA_BLOCK 0x10000
+
+typedef struct arena_block_t {
+    struct arena_block_t *next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;
+    arena_block_t *cur;
+} arena_t;
+
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t *a);
+void *arena_alloc(arena_t *a, size_t size);
+char *arena_strdup(arena_t *a, const char *s);
+arena_mark_t arena_mark(arena_t *a);
+void arena_release(arena_t *a, arena_mark_t m);
+void arena_free(arena_t *a);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef BDCOPY_H
+#define BDCOPY_H
+
+#include "types.h"
+
+// bdcopy.pbm starts with a header, then holds one byte per block of the
+// disc install, non zero once the block has been copied. The blocks cover
+// app.pkg evenly.
+#define BDCOPY_HEADER 0x100
+
+// 64-bit big endian offset of the PFS image in app.pkg.
+#define BDCOPY_IMAGE_OFFSET 0x410
+
+// Seconds without a block copied before the copy counts as stalled.
+#define BDCOPY_STALL 300
+
+// The bitmap is re-read in chunks, chunks with every block copied are
+// settled and never read again.
+#define BDCOPY_CHUNK 0x1000
+
+typedef struct {
+    char path[64];
+    int fd;
+    uint8_t *map;
+    size_t blocks;
+    size_t copied;
+    uint16_t *chunk_copied;
+    size_t chunks;
+    size_t first;
+    int complete;
+    time_t start;
+    size_t start_copied;
+    uint32_t rate;
+    uint32_t eta;
+    char pkg[64];
+    uint64_t span;
+    uint64_t image;
+    time_t changed;
+    uint32_t stall;
+    int failed;
+    ScePthreadMutex mutex;
+} bdcopy_t;
+
+int bdcopy_open(bdcopy_t *bd, char *title_id);
+void bdcopy_close(bdcopy_t *bd);
+int bdcopy_poll(bdcopy_t *bd);
+int bdcopy_locate(bdcopy_t *bd, char *pkgfn);
+int bdcopy_image(bdcopy_t *bd, uint64_t *offset);
+int bdcopy_ready(bdcopy_t *bd, uint64_t offset, uint64_t size);
+int bdcopy_wait(bdcopy_t *bd, uint64_t offset, uint64_t size);
+int bdcopy_stalled(bdcopy_t *bd);
+
+#endif
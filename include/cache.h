@@ -0,0 +1,40 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "types.h"
+
+#define CACHE_MAGIC 0x43414344 // DCAC
+
+typedef struct {
+    uint64_t size;
+    uint64_t h1;
+    uint64_t h2;
+} cache_key_t;
+
+struct cache_entry_t
+{
+    cache_key_t key;
+    uint64_t elfsize;
+    uint64_t used;
+};
+
+struct cache_index_t
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t clock;
+};
+
+extern int cache_hits;
+extern int cache_misses;
+
+void cache_open(char *usb_path);
+void cache_close(void);
+int cache_enabled(void);
+void cache_path(cache_key_t *key, char *path);
+int cache_key(char *selfFile, cache_key_t *key, uint8_t *buf, size_t bufsz);
+int cache_get(cache_key_t *key, char *saveFile, int *reserved, uint8_t *buf, size_t bufsz);
+int cache_put(cache_key_t *key, char *saveFile, uint8_t *buf, size_t bufsz);
+void cache_drop(cache_key_t *key);
+
+#endif
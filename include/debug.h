@@ -1,27 +1,50 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
+// libPS4 has no <inttypes.h>.
+#ifndef PRIx64
 #define PRIx64 "llx"
 #define PRIu64 "llu"
 #define PRId64 "lld"
+#endif
 
 int sock;
-char notify_buf[512];
 
 void initDebugSocket(void);
 void closeDebugSocket(void);
 
+// Log levels, lines above LOG_LEVEL compile out. printfsocket() logs at
+// LOG_INFO, tracesocket() is for per entry output of the parsers.
+#define LOG_ERROR 0
+#define LOG_INFO  1
+#define LOG_TRACE 2
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
 #ifdef DEBUG_SOCKET
-#define printfsocket(format, ...)\
+// Lines longer than the buffer are cut, log_write() ends them.
+void log_write(const char *line, int size);
+
+#define logsocket(level, format, ...)\
 do {\
-	char __printfsocket_buffer[512];\
-	int __printfsocket_size = sprintf(__printfsocket_buffer, format, ##__VA_ARGS__);\
-	sceNetSend(sock, __printfsocket_buffer, __printfsocket_size, 0);\
+	if ((level) <= LOG_LEVEL) {\
+		char __printfsocket_buffer[512];\
+		int __printfsocket_size = snprintf(__printfsocket_buffer, sizeof(__printfsocket_buffer), format, ##__VA_ARGS__);\
+		if (__printfsocket_size >= (int)sizeof(__printfsocket_buffer))\
+			__printfsocket_size = sizeof(__printfsocket_buffer) - 1;\
+		if (__printfsocket_size > 0)\
+			log_write(__printfsocket_buffer, __printfsocket_size);\
+	}\
 } while(0)
 #else
-#define printfsocket(format, ...) (void)0
+#define logsocket(level, format, ...) (void)0
 #endif
 
+#define printfsocket(format, ...) logsocket(LOG_INFO, format, ##__VA_ARGS__)
+#define tracesocket(format, ...) logsocket(LOG_TRACE, format, ##__VA_ARGS__)
+
 void notify(char *message);
 
 #endif
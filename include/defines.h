@@ -5,7 +5,12 @@
 
 //#define DEBUG_SOCKET
 
+// Override to log elsewhere.
+#ifndef LOG_IP
 #define LOG_IP   "192.168.1.3\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+#endif
+#ifndef LOG_PORT
 #define LOG_PORT 9023
+#endif
 
 #endif
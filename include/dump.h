@@ -2,12 +2,78 @@
 #define DUMP_H
 
 #include "types.h"
+#include "stats.h"
+#include "elf64.h"
 
-int is_self(const char *fn);
-void decrypt_and_dump_self(char *selfFile, char *saveFile);
+#define SELF_MAGIC	0x1D3D154F
+#define ELF_MAGIC	0x464C457F
+
+#define SELF_PT_SCE_VERSION 0x6fffff01
+
+// The SELF header, entries, ELF header and phdrs fit in this much.
+#define SELF_HEADER_MAX 0x4000
+// Enough of a file to tell a SELF, and most of the time its ELF magic.
+#define SELF_PROBE_SIZE 0x400
+
+// SELF segment entry properties.
+#define SELF_ENTRY_ORDERED    0x00000001
+#define SELF_ENTRY_ENCRYPTED  0x00000002
+#define SELF_ENTRY_SIGNED     0x00000004
+#define SELF_ENTRY_COMPRESSED 0x00000008
+#define SELF_ENTRY_BLOCKED    0x00000800
+
+#define SELF_ENTRY_BLOCK_SIZE(props) (1 << (12 + (((props) >> 12) & 0xF)))
+#define SELF_ENTRY_ID(props)         ((props) >> 20)
+
+struct self_header_t
+{
+  uint32_t magic;
+  uint8_t  version;
+  uint8_t  mode;
+  uint8_t  endian;
+  uint8_t  attribs;
+  uint32_t key_type;
+  uint16_t header_size;
+  uint16_t meta_size;
+  uint64_t file_size;
+  uint16_t num_entries;
+  uint16_t flags;
+  uint32_t pad;
+} __attribute__((packed));
+
+struct self_entry_t
+{
+  uint64_t props;
+  uint64_t offset;
+  uint64_t filesz;
+  uint64_t memsz;
+} __attribute__((packed));
+
+// A segment of the output ELF, see parse_phdr().
+typedef struct {
+    int index;
+    uint32_t type;
+    uint64_t fileoff;
+    size_t bufsz;
+    size_t filesz;
+    size_t pad;
+    int enc;
+    int comp;
+    uint64_t selfoff;
+    size_t selfsz;
+} SegmentBufInfo;
+
+int is_self_header(const uint8_t *buf, size_t size);
+int is_self(const char *fn, stats_t *st);
+int is_asset_name(const char *name);
+struct self_entry_t *find_self_entry(struct self_entry_t *entries, int num, int index);
+SegmentBufInfo *parse_phdr(Elf64_Phdr *phdrs, int num, struct self_entry_t *entries, int entnum, uint64_t selfsz, int *segBufNum);
+uint64_t self_output_size(uint8_t *buf, size_t size, uint64_t selfsz);
+int decrypt_and_dump_self(char *selfFile, char *saveFile);
 int wait_for_game(char *title_id);
 int wait_for_bdcopy(char *title_id);
 int wait_for_usb(char *usb_name, char *usb_path);
-void dump_game(char *title_id, char *usb_path);
+int dump_game(char *title_id, char *usb_path);
+void dump_progress(char *msg);
 
 #endif
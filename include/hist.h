@@ -0,0 +1,29 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include "types.h"
+#include "stats.h"
+
+// Latency histograms of the source reads and the output writes. Buckets
+// are log-linear, 8 per power of two of microseconds, so every reported
+// percentile is within 12.5% of the real value. Each thread records into
+// its own table without locking and gives it back with hist_release()
+// when it exits, hist_json() merges them once the dump threads are gone.
+#define HIST_BUCKETS 256
+#define HIST_THREADS 64
+
+enum {
+    HIST_PFS_READ,
+    HIST_PKG_READ,
+    HIST_SELF_READ,
+    HIST_WRITE,
+    HIST_NUM
+};
+
+void hist_open(void);
+void hist_record(int op, uint64_t start);
+void hist_release(void);
+int hist_json(char *buf, int op);
+void hist_close(void);
+
+#endif
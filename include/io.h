@@ -0,0 +1,87 @@
+#ifndef IO_H
+#define IO_H
+
+#include "types.h"
+
+#define IO_MAX_DEVICES 8
+
+// io_free_space() when the output isn't a disk.
+#define IO_SPACE_UNKNOWN 0xFFFFFFFFFFFFFFFFULL
+
+// TITLE_ID.pack layout: a header, the records of every file in the order
+// they were written, an end record, the index, then a trailer pointing at
+// the index. The same stream is what the network output sends.
+//
+// Every file or directory first gets an entry record, its raw field holds
+// the entry type and the data is the name, relative to the USB root,
+// without terminator. Data records of files written at the same time are
+// interleaved, each one carries its file and offset and holds raw bytes of
+// the file, either stored or as one LZ4 block. Index entries are a header
+// followed by the name and give the final sizes. See tool/unpack.c.
+#define IO_PACK_MAGIC 0x4B415044 // DPAK
+#define IO_PACK_STAGE 0x100000
+
+#define IO_PACK_FILE 0
+#define IO_PACK_DIR  1
+
+#define IO_CODEC_STORED 0
+#define IO_CODEC_LZ4    1
+#define IO_CODEC_ENTRY  2
+#define IO_CODEC_END    3
+
+// A file gives up on compression after this many blocks in a row that
+// didn't shrink.
+#define IO_COMPRESS_TRIES 4
+
+struct io_pack_header_t
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t index;
+};
+
+struct io_pack_record_t
+{
+    uint32_t id;
+    uint32_t len;
+    uint64_t offset;
+    uint32_t raw;
+    uint32_t codec;
+};
+
+struct io_pack_entry_t
+{
+    uint64_t size;
+    uint32_t type;
+    uint32_t namelen;
+};
+
+typedef struct {
+    int fd;
+    int dev;
+    int id;
+    uint64_t pos;
+    uint64_t hint;
+    uint64_t written;
+    char *rel;
+    uint8_t *zbuf;
+    uint32_t *ztable;
+    int zfails;
+} io_file_t;
+
+int io_probe_usb(int index, char *path);
+uint64_t io_free_space(char *usb_path, uint32_t *bsize);
+void io_init(char *usb_path, char *title_id, int writers);
+int io_fini(void);
+int io_devices(void);
+int io_direct(void);
+io_file_t *io_open(const char *path, uint64_t size);
+ssize_t io_write(io_file_t *f, const void *buf, size_t size);
+int io_seek(io_file_t *f, uint64_t offset);
+int io_close(io_file_t *f);
+int io_mkdir(const char *path);
+void io_mkdir_stats(uint32_t *calls, uint32_t *skipped);
+void io_pack_stats(uint64_t *raw, uint64_t *stored);
+uint64_t io_written(void);
+
+#endif
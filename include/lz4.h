@@ -0,0 +1,13 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "types.h"
+
+#define LZ4_HASH_LOG 12
+#define LZ4_TABLE_SIZE (sizeof(uint32_t) << LZ4_HASH_LOG)
+
+#define LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap, uint32_t *table, int accel);
+
+#endif
@@ -4,11 +4,37 @@
 #define SPLIT_APP   1
 #define SPLIT_PATCH 2
 
+// Bits of configuration.manual, keys the USB probe must not change as
+// dumper.cfg sets them.
+#define CFG_DECRYPT_WINDOW 1
+#define CFG_IO_WRITERS     2
+#define CFG_ARCHIVE        4
+#define CFG_COMPRESS       8
+
 typedef struct
 {
     int split;
     int notify;
     int shutdown;
+    int keep_selfs;
+    int decrypt_queue;
+    int decrypt_window;
+    int decrypt_jobs;
+    int cache_size;
+    int skip_assets;
+    int io_writers;
+    int stripe;
+    int archive;
+    int compress;
+    int compress_block;
+    int compress_level;
+    char net_host[16];
+    int net_port;
+    int space_check;
+    int trace;
+    int usb_probe;
+    int usb_probe_save;
+    int manual;
 } configuration;
 
 extern configuration config;
@@ -0,0 +1,21 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "types.h"
+
+// Notification thread. Progress text is published with notify_set() and
+// shown every `notify` seconds from dumper.cfg while it is set, updates in
+// between are only stored. Messages posted with notify_post() are shown
+// as soon as possible, in order. The thread sleeps on a condition
+// variable, it only wakes up when progress starts or stops, a message is
+// posted or the interval is up.
+#define NOTIFY_SIZE  256
+#define NOTIFY_QUEUE 8
+
+void notify_start(void (*decorate)(char *msg));
+void notify_stop(void);
+void notify_set(const char *msg);
+void notify_clear(void);
+void notify_post(const char *msg);
+
+#endif
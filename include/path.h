@@ -0,0 +1,22 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include "types.h"
+
+// Path built up while walking a tree: path_push() appends a component and
+// returns the length to go back to with path_pop(), so the parent part is
+// never formatted again. The buffer grows as needed, don't keep pointers
+// into it across a push.
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} path_t;
+
+void path_init(path_t *p, const char *base);
+size_t path_push(path_t *p, const char *name);
+size_t path_pushn(path_t *p, const char *name, size_t n);
+void path_pop(path_t *p, size_t len);
+void path_free(path_t *p);
+
+#endif
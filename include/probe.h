@@ -0,0 +1,58 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "types.h"
+
+// Short calibration of the USB disk before dumping, usb_probe in
+// dumper.cfg. A few MB are written with different chunk sizes and numbers
+// of writers and read back, the results pick decrypt_window and
+// io_writers, and with usb_probe=2 the pack/compress mode for slow disks.
+// Keys set in dumper.cfg are never changed. usb_probe_measure() goes
+// through a probe_io_t and usb_probe_pick() is pure, neither depends on the
+// payload (probe_io.c has its side), so both build and run on a PC.
+#define PROBE_BYTES  0x400000
+#define PROBE_CHUNKS 3
+#define PROBE_DEPTHS 3
+#define PROBE_FILES  32
+
+// Below these a disk counts as slow, in KiB/s written and files/s created.
+#define PROBE_SLOW_WRITE 16384
+#define PROBE_SLOW_FILES 100
+
+typedef struct {
+    uint32_t chunk[PROBE_CHUNKS];
+    uint32_t chunk_rate[PROBE_CHUNKS];
+    uint32_t depth[PROBE_DEPTHS];
+    uint32_t depth_rate[PROBE_DEPTHS];
+    uint32_t read_rate;
+    uint32_t file_rate;
+    int verified;
+} probe_t;
+
+typedef struct {
+    int decrypt_window;
+    int io_writers;
+    int archive;
+    int compress;
+} probe_profile_t;
+
+// The file calls and the clock the measurements use, in microseconds.
+// open() writes to a new, empty file with write set and returns -1 on
+// error. parallel() calls fn with each of the num args at the same time
+// and returns once all of them did.
+typedef struct {
+    int (*open)(const char *path, int write);
+    ssize_t (*read)(int fd, void *buf, size_t size);
+    ssize_t (*write)(int fd, const void *buf, size_t size);
+    void (*sync)(int fd);
+    void (*close)(int fd);
+    void (*unlink)(const char *path);
+    uint64_t (*now)(void);
+    void (*parallel)(void *(*fn)(void *), void **args, int num);
+} probe_io_t;
+
+int usb_probe_measure(const char *dir, const probe_io_t *io, probe_t *p);
+void usb_probe_pick(const probe_t *p, int level, probe_profile_t *out);
+void usb_probe(char *usb_path, char *cfg_path);
+
+#endif
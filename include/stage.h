@@ -0,0 +1,21 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include "stats.h"
+
+#define STAGE_MAX_DEPS 4
+
+typedef struct {
+    const char *name;
+    void (*run)(void *arg);
+    void *arg;
+    int enabled;
+    int deps[STAGE_MAX_DEPS];
+    int ndeps;
+    int done;
+    stats_t *stats;
+} stage_t;
+
+void stage_run_all(stage_t *stages, int num);
+
+#endif
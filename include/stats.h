@@ -0,0 +1,28 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"
+
+// Counters of one dump phase. Calls are the file syscalls the phase issued
+// itself (open, read, write, seek, mmap, close), output writes count once
+// whatever the output layer makes of them. Every function takes NULL for
+// code that runs outside of a dump.
+typedef struct {
+    const char *name;
+    uint64_t started;
+    uint64_t elapsed;
+    uint64_t read;
+    uint64_t written;
+    uint32_t files;
+    uint32_t calls;
+} stats_t;
+
+uint64_t stats_now(void);
+void stats_start(stats_t *st, const char *name);
+void stats_stop(stats_t *st);
+void stats_io(stats_t *st, uint32_t calls, uint64_t read, uint64_t written);
+void stats_file(stats_t *st);
+void stats_sum(stats_t *total, stats_t *st);
+int stats_json(char *buf, stats_t *st);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+#include "stats.h"
+
+// Span tracing in the Chrome trace event format, trace=1 in dumper.cfg.
+// A span is a trace_begin()/trace_end() pair, both are a single branch
+// while tracing is off. Events go into a buffer allocated up front and are
+// written out as JSON by trace_close(), chrome://tracing and Perfetto both
+// open it.
+#define TRACE_MAX_EVENTS 0x20000
+
+extern int trace_enabled;
+
+void trace_open(void);
+void trace_thread(const char *name);
+void trace_event(const char *name, uint64_t start, uint64_t arg);
+void trace_close(const char *path);
+
+static inline uint64_t trace_begin(void)
+{
+    return trace_enabled ? stats_now() : 0;
+}
+
+// arg is shown with the span, a size or an index depending on the span.
+static inline void trace_end(const char *name, uint64_t start, uint64_t arg)
+{
+    if (start)
+        trace_event(name, start, arg);
+}
+
+#endif
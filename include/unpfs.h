@@ -1,6 +1,10 @@
 #ifndef UNPFS_H
 #define UNPFS_H
 
+#include "bdcopy.h"
+#include "stats.h"
+#include "arena.h"
+
 struct pfs_header_t
 {
   uint64_t version;
@@ -47,6 +51,50 @@ struct dirent_t
   //char name[namelen+1];
 } __attribute__((packed));
 
-int unpfs(char *pfsfn, char *tidpath);
+// Internal structures.
+struct pfs_t
+{
+  int fd;
+  struct pfs_header_t header;
+  struct di_d32 *inodes;
+  stats_t *stats;
+  bdcopy_t *bd;
+  uint64_t base;
+  int failed;
+};
+
+struct pfs_entry_t
+{
+  char *name;
+  int src;
+  int dir;
+  uint64_t offset;
+  uint64_t size;
+};
+
+#define PFS_NO_ENTRY 0xFFFFFFFF
+
+struct pfs_manifest_t
+{
+  struct pfs_entry_t *entries;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t *table;
+  uint32_t tsize;
+  arena_t names;
+  uint64_t size;
+};
+
+struct unpfs_t
+{
+  struct pfs_manifest_t manifest;
+  uint64_t copied;
+  char *copy_buffer;
+  stats_t *stats;
+};
+
+int unpfs(char *pfsfn, char *tidpath, stats_t *st);
+int unpfs_merge(char *appfn, char *patchfn, char *tidpath, bdcopy_t *bd, stats_t *st);
+uint64_t unpfs_estimate(char *appfn, char *patchfn, bdcopy_t *bd, uint32_t *files);
 
 #endif
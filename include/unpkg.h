@@ -92,6 +92,11 @@ struct file_entry
   char *name;
 };
 
-int unpkg(char *pkgfn, char *tidpath);
+#include "stats.h"
+#include "bdcopy.h"
+
+// bd is the disc install the package is still coming from, or NULL.
+int unpkg(char *pkgfn, char *tidpath, bdcopy_t *bd, stats_t *st);
+uint64_t unpkg_estimate(char *pkgfn, bdcopy_t *bd, uint32_t *files);
 
 #endif
@@ -0,0 +1,92 @@
+#include "ps4.h"
+#include "defines.h"
+#include "arena.h"
+
+// Block headers are padded so that every allocation is 16 byte aligned.
+#define ARENA_HEADER ((sizeof(arena_block_t) + 15) & ~(size_t)15)
+
+void arena_init(arena_t *a)
+{
+    a->head = NULL;
+    a->cur = NULL;
+}
+
+// Moves on to the blocks left from before a release first, a new block is
+// only added at the end of the chain.
+void *arena_alloc(arena_t *a, size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    arena_block_t *b = a->cur;
+    while (b != NULL)
+    {
+        if (b->used + size <= b->size)
+        {
+            void *p = (uint8_t *)b + ARENA_HEADER + b->used;
+            b->used += size;
+            a->cur = b;
+            return p;
+        }
+        if (b->next == NULL)
+            break;
+        b = b->next;
+        b->used = 0;
+    }
+
+    size_t bsize = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+    arena_block_t *nb = malloc(ARENA_HEADER + bsize);
+    if (nb == NULL)
+        return NULL;
+    nb->next = NULL;
+    nb->size = bsize;
+    nb->used = size;
+    if (b != NULL)
+        b->next = nb;
+    else
+        a->head = nb;
+    a->cur = nb;
+    return (uint8_t *)nb + ARENA_HEADER;
+}
+
+char *arena_strdup(arena_t *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = arena_alloc(a, len);
+    if (p != NULL)
+        memcpy(p, s, len);
+    return p;
+}
+
+arena_mark_t arena_mark(arena_t *a)
+{
+    arena_mark_t m;
+    m.block = a->cur;
+    m.used = (a->cur != NULL) ? a->cur->used : 0;
+    return m;
+}
+
+void arena_release(arena_t *a, arena_mark_t m)
+{
+    if (m.block != NULL)
+    {
+        a->cur = m.block;
+        a->cur->used = m.used;
+    }
+    else
+    {
+        a->cur = a->head;
+        if (a->cur != NULL)
+            a->cur->used = 0;
+    }
+}
+
+void arena_free(arena_t *a)
+{
+    arena_block_t *b = a->head;
+    while (b != NULL)
+    {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena_init(a);
+}
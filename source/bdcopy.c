@@ -0,0 +1,260 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "bdcopy.h"
+
+// Tracks the disc install through its block bitmap so extraction can start
+// on the parts that are already on the HDD.
+
+// Override to point the tracker at a simulated bitmap.
+#ifndef BDCOPY_PATH
+#define BDCOPY_PATH "/system_data/playgo/%s/bdcopy.pbm"
+#endif
+
+// Waits between bitmap reads, overridable for the same reason.
+#ifndef BDCOPY_POLL_USEC
+#define BDCOPY_POLL_USEC 1000000
+#endif
+
+int bdcopy_open(bdcopy_t *bd, char *title_id)
+{
+    memset(bd, 0, sizeof(bdcopy_t));
+    sprintf(bd->path, BDCOPY_PATH, title_id);
+    bd->fd = -1;
+    bd->stall = BDCOPY_STALL;
+    scePthreadMutexInit(&bd->mutex, NULL, "bdcopy");
+    return bdcopy_poll(bd);
+}
+
+void bdcopy_close(bdcopy_t *bd)
+{
+    if (bd->fd != -1)
+        close(bd->fd);
+    free(bd->map);
+    free(bd->chunk_copied);
+    bd->map = NULL;
+    bd->chunk_copied = NULL;
+    scePthreadMutexDestroy(&bd->mutex);
+}
+
+static int bdcopy_done(bdcopy_t *bd)
+{
+    scePthreadMutexLock(&bd->mutex);
+    bd->complete = 1;
+    bd->eta = 0;
+    scePthreadMutexUnlock(&bd->mutex);
+    return 100;
+}
+
+// Counts the non zero bytes, eight per step: the high bit of every byte of
+// the mask is set when the byte isn't zero.
+static size_t count_copied(const uint8_t *p, size_t n)
+{
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t x = *(const uint64_t *)(p + i);
+        count += __builtin_popcountll((((x & low7) + low7) | x) & ~low7);
+    }
+    for (; i < n; i++)
+    {
+        if (p[i]) count++;
+    }
+    return count;
+}
+
+static inline size_t chunk_size(bdcopy_t *bd, size_t c)
+{
+    return (c + 1 < bd->chunks) ? BDCOPY_CHUNK : bd->blocks - c * BDCOPY_CHUNK;
+}
+
+static int bdcopy_attach(bdcopy_t *bd)
+{
+    struct stat info;
+    int fd = open(bd->path, O_RDONLY, 0);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &info) || (info.st_size <= BDCOPY_HEADER))
+    {
+        close(fd);
+        return -1;
+    }
+
+    bd->fd = fd;
+    bd->blocks = info.st_size - BDCOPY_HEADER;
+    bd->chunks = (bd->blocks + BDCOPY_CHUNK - 1) / BDCOPY_CHUNK;
+    bd->map = malloc(bd->blocks);
+    bd->chunk_copied = malloc(sizeof(uint16_t) * bd->chunks);
+    memset(bd->map, 0, bd->blocks);
+    memset(bd->chunk_copied, 0, sizeof(uint16_t) * bd->chunks);
+    bd->start = time(NULL);
+    bd->changed = bd->start;
+    return 0;
+}
+
+// Re-reads the chunks that aren't settled yet and returns the percentage
+// copied. No bitmap means nothing is being installed.
+int bdcopy_poll(bdcopy_t *bd)
+{
+    if (bd->complete)
+        return 100;
+
+    int fresh = (bd->fd == -1);
+    if (fresh && bdcopy_attach(bd))
+        return bdcopy_done(bd);
+
+    scePthreadMutexLock(&bd->mutex);
+
+    size_t c = bd->first;
+    while (c < bd->chunks)
+    {
+        if (bd->chunk_copied[c] == chunk_size(bd, c))
+        {
+            c++;
+            continue;
+        }
+
+        // Read the whole run of unsettled chunks at once.
+        size_t end = c + 1;
+        while ((end < bd->chunks) && (bd->chunk_copied[end] < chunk_size(bd, end)))
+            end++;
+        size_t offset = c * BDCOPY_CHUNK;
+        size_t len = ((end < bd->chunks) ? end * BDCOPY_CHUNK : bd->blocks) - offset;
+        lseek(bd->fd, BDCOPY_HEADER + offset, SEEK_SET);
+        read(bd->fd, bd->map + offset, len);
+
+        for (; c < end; c++)
+        {
+            size_t n = count_copied(bd->map + c * BDCOPY_CHUNK, chunk_size(bd, c));
+            if (n != bd->chunk_copied[c])
+                bd->changed = time(NULL);
+            bd->copied += n - bd->chunk_copied[c];
+            bd->chunk_copied[c] = n;
+        }
+    }
+
+    while ((bd->first < bd->chunks) && (bd->chunk_copied[bd->first] == chunk_size(bd, bd->first)))
+        bd->first++;
+
+    if (bd->copied == bd->blocks)
+        bd->complete = 1;
+
+    // Average speed since the tracker was opened.
+    time_t elapsed = time(NULL) - bd->start;
+    if (fresh)
+        bd->start_copied = bd->copied;
+    else
+    if (elapsed > 0)
+    {
+        bd->rate = (bd->copied - bd->start_copied) / elapsed;
+        bd->eta = bd->rate ? (bd->blocks - bd->copied) / bd->rate : 0;
+    }
+
+    int progress = (int)(bd->copied * 100 / bd->blocks);
+    scePthreadMutexUnlock(&bd->mutex);
+
+    return progress;
+}
+
+// Ties the bitmap to the package it covers. The install preallocates
+// app.pkg, so its size is known from the start. Without it ranges are only
+// ready once the whole copy is. Returns 0 on success.
+int bdcopy_locate(bdcopy_t *bd, char *pkgfn)
+{
+    struct stat info;
+    if (stat(pkgfn, &info) || (info.st_size <= 0))
+        return -1;
+    snprintf(bd->pkg, sizeof(bd->pkg), "%s", pkgfn);
+    bd->span = info.st_size;
+    return 0;
+}
+
+// Offset of the PFS image in the package, read from the content header
+// once that part is copied. Without a package it is 0, every range waits
+// for the copy to complete then. Returns -1 if the copy stalled.
+int bdcopy_image(bdcopy_t *bd, uint64_t *offset)
+{
+    uint8_t be[8];
+
+    if (bdcopy_wait(bd, BDCOPY_IMAGE_OFFSET, sizeof(be)))
+        return -1;
+    if ((bd->image == 0) && (bd->span != 0))
+    {
+        int fd = open(bd->pkg, O_RDONLY, 0);
+        if (fd == -1)
+            return -1;
+        ssize_t got = syscall(475, fd, be, sizeof(be), BDCOPY_IMAGE_OFFSET);
+        close(fd);
+        if (got != sizeof(be))
+            return -1;
+        uint64_t image = 0;
+        for (int i = 0; i < 8; i++)
+            image = (image << 8) | be[i];
+        if ((image == 0) || (image >= bd->span))
+            return -1;
+        bd->image = image;
+    }
+    *offset = bd->image;
+    return 0;
+}
+
+// Checks whether a byte range of the package is already copied.
+int bdcopy_ready(bdcopy_t *bd, uint64_t offset, uint64_t size)
+{
+    int ready = 1;
+
+    scePthreadMutexLock(&bd->mutex);
+    if (!bd->complete)
+    {
+        uint64_t span = bd->span;
+        uint64_t end = offset + (size ? size : 1);
+        if (end > span) end = span;
+        if ((span == 0) || (bd->blocks == 0) || (offset >= end))
+            ready = 0;
+        else
+        {
+            size_t first = offset * bd->blocks / span;
+            size_t last = ((end - 1) * bd->blocks) / span;
+            for (size_t i = first; (i <= last) && (i < bd->blocks); i++)
+            {
+                if (!bd->map[i])
+                {
+                    ready = 0;
+                    break;
+                }
+            }
+        }
+    }
+    scePthreadMutexUnlock(&bd->mutex);
+
+    return ready;
+}
+
+// Waits for a range of the package to be copied, returns -1 if the copy
+// stalled first.
+int bdcopy_wait(bdcopy_t *bd, uint64_t offset, uint64_t size)
+{
+    while (!bdcopy_ready(bd, offset, size))
+    {
+        if (bdcopy_stalled(bd))
+            return -1;
+        sceKernelUsleep(BDCOPY_POLL_USEC);
+        bdcopy_poll(bd);
+    }
+    return 0;
+}
+
+// A copy without a new block for bd->stall seconds is taken as stuck, the
+// dump fails rather than wait forever.
+int bdcopy_stalled(bdcopy_t *bd)
+{
+    scePthreadMutexLock(&bd->mutex);
+    if (!bd->complete && bd->stall && (time(NULL) - bd->changed > bd->stall))
+        bd->failed = 1;
+    int failed = bd->failed;
+    scePthreadMutexUnlock(&bd->mutex);
+    return failed;
+}
@@ -0,0 +1,297 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "main.h"
+#include "cache.h"
+#include "io.h"
+#include "dump.h"
+
+// Decrypted module cache on the USB target. Entries are keyed by the
+// encrypted SELF header and evicted least recently used first once the
+// total size goes over cache_size MiB. The index lives in index.dat.
+//
+// A missed key is reserved by the job that missed it, as an entry without
+// elfsize, so a module is decrypted into the cache once however many jobs
+// want it at the same time.
+
+int cache_hits;
+int cache_misses;
+
+static char cache_dir[64];
+static struct cache_entry_t *entries;
+static uint32_t count, capacity;
+static uint64_t clock_now, total;
+static int enabled;
+static ScePthreadMutex mutex;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+void cache_path(cache_key_t *key, char *path)
+{
+    sprintf(path, "%s/%016"PRIx64"%016"PRIx64"%08x.elf", cache_dir, key->h1, key->h2, (uint32_t)key->size);
+}
+
+static void copy_fd(int in, io_file_t *out, uint8_t *buf, size_t bufsz)
+{
+    ssize_t bytes;
+    while (0 < (bytes = read(in, buf, bufsz)))
+        io_write(out, buf, bytes);
+}
+
+static int copy_path(char *src, char *dst, uint8_t *buf, size_t bufsz)
+{
+    int in = open(src, O_RDONLY, 0);
+    if (in == -1)
+        return -1;
+    io_file_t *out = io_open(dst, 0);
+    if (out == NULL)
+    {
+        close(in);
+        return -1;
+    }
+    copy_fd(in, out, buf, bufsz);
+    io_close(out);
+    close(in);
+    return 0;
+}
+
+static int find_entry(cache_key_t *key)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!memcmp(&entries[i].key, key, sizeof(cache_key_t)))
+            return i;
+    }
+    return -1;
+}
+
+static void evict(void)
+{
+    uint64_t limit = (uint64_t)config.cache_size * 1024 * 1024;
+    char path[128];
+
+    while (total > limit)
+    {
+        int lru = -1;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (entries[i].elfsize && ((lru < 0) || (entries[i].used < entries[lru].used)))
+                lru = i;
+        }
+        if (lru < 0)
+            break;
+        cache_path(&entries[lru].key, path);
+        printfsocket("cache evict %s\n", path);
+        unlink(path);
+        total -= entries[lru].elfsize;
+        entries[lru] = entries[--count];
+    }
+}
+
+void cache_open(char *usb_path)
+{
+    struct cache_index_t index;
+    char path[128];
+
+    cache_hits = cache_misses = 0;
+    enabled = (config.cache_size > 0);
+    if (!enabled)
+        return;
+
+    sprintf(cache_dir, "%s/dumper_cache", usb_path);
+    mkdir(cache_dir, 0777);
+    scePthreadMutexInit(&mutex, NULL, "cache");
+
+    count = capacity = 0;
+    clock_now = total = 0;
+    entries = NULL;
+
+    sprintf(path, "%s/index.dat", cache_dir);
+    int fd = open(path, O_RDONLY, 0);
+    if (fd == -1)
+        return;
+    if ((read(fd, &index, sizeof(index)) == sizeof(index)) && (index.magic == CACHE_MAGIC))
+    {
+        capacity = index.count;
+        entries = malloc(sizeof(struct cache_entry_t) * (capacity ? capacity : 1));
+        if (read(fd, entries, sizeof(struct cache_entry_t) * index.count) == sizeof(struct cache_entry_t) * index.count)
+        {
+            count = index.count;
+            clock_now = index.clock;
+            for (uint32_t i = 0; i < count; i++)
+                total += entries[i].elfsize;
+        }
+    }
+    close(fd);
+    printfsocket("cache %s : %u entries, %"PRIu64" bytes\n", cache_dir, count, total);
+}
+
+void cache_close(void)
+{
+    struct cache_index_t index;
+    char path[128];
+
+    if (!enabled)
+        return;
+
+    evict();
+
+    // Reservations of jobs that never finished aren't kept.
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (entries[i].elfsize)
+            entries[kept++] = entries[i];
+    }
+    count = kept;
+
+    sprintf(path, "%s/index.dat", cache_dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if (fd != -1)
+    {
+        index.magic = CACHE_MAGIC;
+        index.count = count;
+        index.clock = clock_now;
+        write(fd, &index, sizeof(index));
+        write(fd, entries, sizeof(struct cache_entry_t) * count);
+        close(fd);
+    }
+
+    printfsocket("cache : %d hits, %d misses\n", cache_hits, cache_misses);
+
+    free(entries);
+    entries = NULL;
+    scePthreadMutexDestroy(&mutex);
+    enabled = 0;
+}
+
+int cache_enabled(void)
+{
+    return enabled;
+}
+
+// Hashes the file size and the first SELF_HEADER_MAX bytes with two
+// independent 64-bit word hashes. Those hold the SELF header, the entries,
+// the ELF header and phdrs and the extended info with the digest of the
+// ELF, so the rest of the file doesn't need reading. Returns 0 on success.
+int cache_key(char *selfFile, cache_key_t *key, uint8_t *buf, size_t bufsz)
+{
+    int fd = open(selfFile, O_RDONLY, 0);
+    if (fd == -1)
+        return -1;
+
+    size_t want = ((bufsz < SELF_HEADER_MAX) ? bufsz : SELF_HEADER_MAX) & ~7;
+    ssize_t bytes = read(fd, buf, want);
+    key->size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    if (bytes <= 0)
+        return -1;
+
+    if (bytes & 7)
+    {
+        memset(buf + bytes, 0, 8 - (bytes & 7));
+    }
+    key->h1 = 0xCBF29CE484222325;
+    key->h2 = 0x9E3779B97F4A7C15;
+    for (ssize_t i = 0; i < bytes; i += 8)
+    {
+        uint64_t w = *(uint64_t *)(buf + i);
+        key->h1 = (key->h1 ^ w) * 0x100000001B3;
+        key->h2 = rotl64(key->h2 ^ (w * 0xC2B2AE3D27D4EB4F), 31) * 0x9E3779B185EBCA87;
+    }
+    return 0;
+}
+
+// Places a cached ELF at saveFile, returns 0 on a hit. On a miss *reserved
+// tells whether the key is now this job's to fill with cache_put(), or to
+// give back with cache_drop(). A key another job is filling is a miss.
+int cache_get(cache_key_t *key, char *saveFile, int *reserved, uint8_t *buf, size_t bufsz)
+{
+    char path[128];
+
+    *reserved = 0;
+    scePthreadMutexLock(&mutex);
+    int i = find_entry(key);
+    if ((i >= 0) && entries[i].elfsize)
+        entries[i].used = ++clock_now;
+    else
+    if (i < 0)
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            entries = realloc(entries, sizeof(struct cache_entry_t) * capacity);
+        }
+        entries[count].key = *key;
+        entries[count].elfsize = 0;
+        entries[count].used = ++clock_now;
+        count++;
+        *reserved = 1;
+    }
+    int hit = (i >= 0) && entries[i].elfsize;
+    scePthreadMutexUnlock(&mutex);
+
+    if (hit)
+    {
+        cache_path(key, path);
+        unlink(saveFile);
+        if ((io_direct() && (syscall(9, path, saveFile) == 0)) || (copy_path(path, saveFile, buf, bufsz) == 0))
+        {
+            __atomic_add_fetch(&cache_hits, 1, __ATOMIC_RELAXED);
+            printfsocket("cache hit %s\n", saveFile);
+            return 0;
+        }
+    }
+
+    __atomic_add_fetch(&cache_misses, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+// Publishes the ELF decrypted at cache_path() of a reserved key to saveFile
+// and completes the entry, returns 0 on success. The output may be packed
+// or on another disk, so it is written from the cache and not the other
+// way round.
+int cache_put(cache_key_t *key, char *saveFile, uint8_t *buf, size_t bufsz)
+{
+    struct stat st;
+    char path[128];
+
+    cache_path(key, path);
+    if (stat(path, &st) || (st.st_size == 0))
+        return -1;
+
+    unlink(saveFile);
+    if (!(io_direct() && (syscall(9, path, saveFile) == 0)) && copy_path(path, saveFile, buf, bufsz))
+        return -1;
+
+    scePthreadMutexLock(&mutex);
+    int i = find_entry(key);
+    if (i >= 0)
+    {
+        entries[i].elfsize = st.st_size;
+        entries[i].used = ++clock_now;
+        total += st.st_size;
+        evict();
+    }
+    scePthreadMutexUnlock(&mutex);
+
+    return 0;
+}
+
+// Gives back a reserved key whose module couldn't be cached.
+void cache_drop(cache_key_t *key)
+{
+    char path[128];
+
+    cache_path(key, path);
+    unlink(path);
+
+    scePthreadMutexLock(&mutex);
+    int i = find_entry(key);
+    if ((i >= 0) && !entries[i].elfsize)
+        entries[i] = entries[--count];
+    scePthreadMutexUnlock(&mutex);
+}
@@ -7,6 +7,154 @@
 
 int sock;
 
+// Lines are queued in a ring of fixed size slots and sent by a background
+// thread, so logging never waits on the network. Producers claim a slot
+// with a compare and swap on the head, the sequence number of a slot tells
+// whether it is free, filled or still being written (a bounded MPMC queue
+// after Vyukov, with a single consumer here). When the ring is full the
+// line is dropped and counted, the drops are reported in the stream.
+//
+// The sender sleeps on a condition while the ring is empty. Before it does
+// it raises log_waiting and looks at the ring once more; the producer that
+// finds the flag raised takes it down and wakes the sender, so only the
+// line that makes the ring non-empty pays for the mutex. The wait has a
+// timeout, a missed wake up only delays the lines.
+
+#define LOG_SLOTS 4096
+#define LOG_SLOT  256
+#define LOG_BATCH 0x10000
+#define LOG_IDLE_USEC 100000
+
+typedef struct {
+	uint32_t seq;
+	uint32_t size;
+	char line[LOG_SLOT - 8];
+} LogSlot;
+
+static LogSlot *log_ring;
+static uint32_t log_head;
+static uint32_t log_tail;
+static uint32_t log_dropped;
+static int log_run;
+static int log_waiting;
+static ScePthread log_thread;
+static ScePthreadMutex log_mutex;
+static ScePthreadCond log_cond;
+
+static void log_wake(void)
+{
+	scePthreadMutexLock(&log_mutex);
+	scePthreadCondSignal(&log_cond);
+	scePthreadMutexUnlock(&log_mutex);
+}
+
+void log_write(const char *line, int size)
+{
+	if (log_ring == NULL)
+		return;
+
+	uint32_t pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	LogSlot *slot;
+	while (1)
+	{
+		slot = &log_ring[pos % LOG_SLOTS];
+		int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else
+		if (diff < 0)
+		{
+			__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+
+	if (size > (int)sizeof(slot->line))
+	{
+		size = sizeof(slot->line);
+		memcpy(slot->line, line, size - 1);
+		slot->line[size - 1] = '\n';
+	}
+	else
+		memcpy(slot->line, line, size);
+	slot->size = size;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&log_waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&log_waiting, 0, __ATOMIC_RELAXED))
+		log_wake();
+}
+
+static void log_send(char *buf, size_t size)
+{
+	while (size > 0)
+	{
+		int sent = sceNetSend(sock, buf, size, 0);
+		if (sent <= 0)
+			return;
+		buf += sent;
+		size -= sent;
+	}
+}
+
+// Moves every filled slot into one batch, returns its size.
+static size_t log_drain(char *batch)
+{
+	size_t size = 0;
+	uint32_t dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		size += sprintf(batch, "[log] %u lines dropped\n", dropped);
+
+	while (size + LOG_SLOT <= LOG_BATCH)
+	{
+		LogSlot *slot = &log_ring[log_tail % LOG_SLOTS];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+			break;
+		memcpy(batch + size, slot->line, slot->size);
+		size += slot->size;
+		__atomic_store_n(&slot->seq, log_tail + LOG_SLOTS, __ATOMIC_RELEASE);
+		log_tail++;
+	}
+	return size;
+}
+
+// Sleeps until a line comes in, the sender is stopped or the timeout.
+static void log_idle(void)
+{
+	scePthreadMutexLock(&log_mutex);
+	__atomic_store_n(&log_waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	LogSlot *slot = &log_ring[log_tail % LOG_SLOTS];
+	if ((__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_tail + 1) && __atomic_load_n(&log_run, __ATOMIC_ACQUIRE))
+		scePthreadCondTimedwait(&log_cond, &log_mutex, LOG_IDLE_USEC);
+	__atomic_store_n(&log_waiting, 0, __ATOMIC_RELAXED);
+	scePthreadMutexUnlock(&log_mutex);
+}
+
+static void *log_thread_func(void *arg)
+{
+	char *batch = malloc(LOG_BATCH);
+	while (1)
+	{
+		int run = __atomic_load_n(&log_run, __ATOMIC_ACQUIRE);
+		size_t size = log_drain(batch);
+		if (size > 0)
+			log_send(batch, size);
+		else
+		if (!run)
+			break;
+		else
+			log_idle();
+	}
+	free(batch);
+	return NULL;
+}
+
 void initDebugSocket(void)
 {
 	struct sockaddr_in server;
@@ -19,12 +167,25 @@ void initDebugSocket(void)
 	sock = sceNetSocket("debug", AF_INET, SOCK_STREAM, 0);
 	sceNetConnect(sock, (struct sockaddr *)&server, sizeof(server));
 
-	int flag = 1;
-	sceNetSetsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+	log_ring = malloc(sizeof(LogSlot) * LOG_SLOTS);
+	for (uint32_t i = 0; i < LOG_SLOTS; i++)
+		log_ring[i].seq = i;
+	log_head = log_tail = log_dropped = 0;
+	log_waiting = 0;
+	log_run = 1;
+	scePthreadMutexInit(&log_mutex, NULL, "log");
+	scePthreadCondInit(&log_cond, NULL, "log");
+	scePthreadCreate(&log_thread, NULL, log_thread_func, NULL, "log");
 }
 
+// Sends what is still queued before closing.
 void closeDebugSocket(void)
 {
+	__atomic_store_n(&log_run, 0, __ATOMIC_RELEASE);
+	log_wake();
+	scePthreadJoin(log_thread, NULL);
+	scePthreadCondDestroy(&log_cond);
+	scePthreadMutexDestroy(&log_mutex);
 	sceNetSocketClose(sock);
 }
 
@@ -34,6 +195,6 @@ void notify(char *message)
 {
 	if (!config.notify) return;
 	char buffer[512];
-	sprintf(buffer, "%s\n\n\n\n\n\n\n", message);
+	snprintf(buffer, sizeof(buffer), "%s\n\n\n\n\n\n\n", message);
 	sceSysUtilSendSystemNotificationWithText(0x81, buffer);
 }
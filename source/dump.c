@@ -3,215 +3,556 @@
 #include "debug.h"
 #include "dump.h"
 #include "main.h"
-#include "elf64.h"
 #include "unpfs.h"
 #include "unpkg.h"
+#include "cache.h"
+#include "io.h"
+#include "stage.h"
+#include "bdcopy.h"
+#include "trace.h"
+#include "hist.h"
+#include "notify.h"
+#include "arena.h"
+#include "path.h"
 
 #define TRUE 1
 #define FALSE 0
 
 extern int run;
 
-typedef struct {
-    int index;
-    uint64_t fileoff;
-    size_t bufsz;
-    size_t filesz;
-    int enc;
-} SegmentBufInfo;
-
 void print_phdr(Elf64_Phdr *phdr) {
-    printfsocket("=================================\n");
-    printfsocket("     p_type %08x\n", phdr->p_type);
-    printfsocket("     p_flags %08x\n", phdr->p_flags);
-    printfsocket("     p_offset %016llx\n", phdr->p_offset);
-    printfsocket("     p_vaddr %016llx\n", phdr->p_vaddr);
-    printfsocket("     p_paddr %016llx\n", phdr->p_paddr);
-    printfsocket("     p_filesz %016llx\n", phdr->p_filesz);
-    printfsocket("     p_memsz %016llx\n", phdr->p_memsz);
-    printfsocket("     p_align %016llx\n", phdr->p_align);
+    tracesocket("=================================\n");
+    tracesocket("     p_type %08x\n", phdr->p_type);
+    tracesocket("     p_flags %08x\n", phdr->p_flags);
+    tracesocket("     p_offset %016"PRIx64"\n", (uint64_t)phdr->p_offset);
+    tracesocket("     p_vaddr %016"PRIx64"\n", (uint64_t)phdr->p_vaddr);
+    tracesocket("     p_paddr %016"PRIx64"\n", (uint64_t)phdr->p_paddr);
+    tracesocket("     p_filesz %016"PRIx64"\n", (uint64_t)phdr->p_filesz);
+    tracesocket("     p_memsz %016"PRIx64"\n", (uint64_t)phdr->p_memsz);
+    tracesocket("     p_align %016"PRIx64"\n", (uint64_t)phdr->p_align);
+}
+
+int is_self_header(const uint8_t *buf, size_t size)
+{
+    struct self_header_t *hdr = (struct self_header_t *)buf;
+    if (size < sizeof(struct self_header_t))
+        return 0;
+    if (hdr->magic != SELF_MAGIC)
+        return 0;
+    size_t ehdroff = sizeof(struct self_header_t) + hdr->num_entries * sizeof(struct self_entry_t);
+    if (size < (ehdroff + 4))
+        return 0;
+    uint32_t elfMagic = *(uint32_t*)(buf + ehdroff);
+    return (elfMagic == ELF_MAGIC);
+}
+
+void print_self_entry(int i, struct self_entry_t *entry) {
+    tracesocket("self entry %d : props %016"PRIx64" offset %016"PRIx64" filesz %016"PRIx64" memsz %016"PRIx64"\n", i, entry->props, entry->offset, entry->filesz, entry->memsz);
+}
+
+// Finds the data entry (the blocked one, the other carries its hashes)
+// that holds the given phdr.
+struct self_entry_t *find_self_entry(struct self_entry_t *entries, int num, int index) {
+    for (int i = 0; i < num; i += 1) {
+        if ((entries[i].props & SELF_ENTRY_BLOCKED) && (SELF_ENTRY_ID(entries[i].props) == index))
+            return &entries[i];
+    }
+    return NULL;
 }
 
-#define SELF_MAGIC	0x1D3D154F
-#define ELF_MAGIC	0x464C457F
+static inline ssize_t read_at(int fd, void *buf, size_t nbytes, uint64_t offset)
+{
+    return syscall(475, fd, buf, nbytes, offset);
+}
 
-int is_self(const char *fn)
+// Classifies a file with a single read of its first bytes, a second small
+// read is only needed when the entry table doesn't fit the probe.
+int is_self(const char *fn, stats_t *st)
 {
-    struct stat st;
+    uint8_t buf[SELF_PROBE_SIZE];
     int res = 0;
     int fd = open(fn, O_RDONLY, 0);
     if (fd != -1) {
-        stat(fn, &st);
-        void *addr = mmap(0, 0x4000, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-        if (addr != MAP_FAILED) {
-            printfsocket("mmap %s : %p\n", fn, addr);
-            if (st.st_size >= 4)
-            {
-                uint32_t selfMagic = *(uint32_t*)((uint8_t*)addr + 0x00);
-                if (selfMagic == SELF_MAGIC)
-                {
-                    uint16_t snum = *(uint16_t*)((uint8_t*)addr + 0x18);
-                    if (st.st_size >= (0x20 + snum * 0x20 + 4))
-                    {
-                        uint32_t elfMagic = *(uint32_t*)((uint8_t*)addr + 0x20 + snum * 0x20);
-                        if ((selfMagic == SELF_MAGIC) && (elfMagic == ELF_MAGIC))
-                            res = 1;
-                    }
-                }
+        ssize_t bytes = read(fd, buf, sizeof(buf));
+        stats_io(st, 3, (bytes > 0) ? bytes : 0, 0);
+        if ((bytes >= (ssize_t)sizeof(struct self_header_t)) && (((struct self_header_t *)buf)->magic == SELF_MAGIC)) {
+            size_t ehdroff = sizeof(struct self_header_t) + ((struct self_header_t *)buf)->num_entries * sizeof(struct self_entry_t);
+            if (ehdroff + 4 <= bytes) {
+                res = is_self_header(buf, bytes);
+            }
+            else {
+                uint32_t elfMagic = 0;
+                res = (read_at(fd, &elfMagic, 4, ehdroff) == 4) && (elfMagic == ELF_MAGIC);
+                stats_io(st, 1, 4, 0);
             }
-            munmap(addr, 0x4000);
-        }
-        else {
-            printfsocket("mmap file %s err : %s\n", fn, strerror(errno));
         }
         close(fd);
     }
     else {
-        printfsocket("open %s err : %s\n", fn, strerror(errno));
+        logsocket(LOG_ERROR, "open %s err : %s\n", fn, strerror(errno));
     }
 
     return res;
 }
 
-#define DECRYPT_SIZE 0x100000
+#ifndef DT_DIR
+#define DT_UNKNOWN 0
+#define DT_DIR     4
+#define DT_REG     8
+#endif
 
-bool read_decrypt_segment(int fd, uint64_t index, uint64_t offset, size_t size, uint8_t *out)
+// Extensions that never hold executables, only used with skip_assets=1.
+static const char *asset_exts[] = {
+    ".png", ".dds", ".gnf", ".jpg", ".at9", ".wav", ".ogg", ".mp3", ".mp4", ".bik", ".bk2", ".usm",
+    ".xml", ".json", ".txt", ".ini", ".csv", ".sfo", ".trp", ".ttf", ".otf", ".psarc", ".pak", NULL
+};
+
+int is_asset_name(const char *name)
 {
-    uint8_t *outPtr = out;
-    uint64_t outSize = size;
-    uint64_t realOffset = (index << 32) | offset;
-    while (outSize > 0)
+    const char *ext = strrchr(name, '.');
+    if (!ext)
+        return 0;
+    for (int i = 0; asset_exts[i]; i++) {
+        const char *a = asset_exts[i];
+        const char *e = ext;
+        while (*a && *e && (*a == ((*e >= 'A' && *e <= 'Z') ? *e + 0x20 : *e))) {
+            a++;
+            e++;
+        }
+        if (!*a && !*e)
+            return 1;
+    }
+    return 0;
+}
+
+#define DECRYPT_PAGE    0x4000
+#define DECRYPT_THREADS 2
+
+typedef struct {
+    int seg;
+    int enc;
+    uint64_t offset;
+    uint64_t outoff;
+    size_t bytes;
+    size_t pad;
+} DecryptWindow;
+
+typedef struct {
+    int fd;
+    DecryptWindow *windows;
+    int count;
+    int depth;
+    uint8_t **bufs;
+    int *ready;
+    int next;
+    int written;
+    ScePthreadMutex mutex;
+    ScePthreadCond cond;
+    stats_t *stats;
+} DecryptPipe;
+
+typedef struct {
+    int depth;
+    size_t window;
+    uint8_t **bufs;
+    stats_t *stats;
+} DecryptBufs;
+
+// Maps (and so decrypts) or reads a single window into buf.
+bool read_decrypt_window(int fd, DecryptWindow *win, uint8_t *buf)
+{
+    uint64_t started = stats_now();
+    uint64_t span = trace_begin();
+    if (win->enc)
     {
-        size_t bytes = (outSize > DECRYPT_SIZE) ? DECRYPT_SIZE : outSize;
-        uint8_t *addr = (uint8_t*)mmap(0, bytes, PROT_READ, MAP_PRIVATE | 0x80000, fd, realOffset);
-        if (addr != MAP_FAILED)
+        uint8_t *addr = (uint8_t*)mmap(0, win->bytes, PROT_READ, MAP_PRIVATE | 0x80000, fd, win->offset);
+        if (addr == MAP_FAILED)
         {
-            memcpy(outPtr, addr, bytes);
-            munmap(addr, bytes);
+            logsocket(LOG_ERROR, "mmap segment [%d] err(%d) : %s\n", win->seg, errno, strerror(errno));
+            return FALSE;
         }
-        else
+        memcpy(buf, addr, win->bytes);
+        munmap(addr, win->bytes);
+        hist_record(HIST_SELF_READ, started);
+        trace_end("decrypt_window", span, win->bytes);
+    }
+    else
+    {
+        if (read_at(fd, buf, win->bytes, win->offset) != win->bytes)
         {
-            printfsocket("mmap segment [%d] err(%d) : %s\n", index, errno, strerror(errno));
+            logsocket(LOG_ERROR, "read segment [%d] err(%d) : %s\n", win->seg, errno, strerror(errno));
             return FALSE;
         }
-        outPtr += bytes;
-        outSize -= bytes;
-        realOffset += bytes;
+        hist_record(HIST_SELF_READ, started);
+        trace_end("read_window", span, win->bytes);
     }
     return TRUE;
 }
 
-int is_segment_in_other_segment(Elf64_Phdr *phdr, int index, Elf64_Phdr *phdrs, int num) {
-    for (int i = 0; i < num; i += 1) {
-        Elf64_Phdr *p = &phdrs[i];
-        if (i != index) {
-            if (p->p_filesz > 0) {
-                printfsocket("offset : %016x,  toffset : %016x\n", phdr->p_offset, p->p_offset);
-                printfsocket("offset : %016x,  toffset + size : %016x\n", phdr->p_offset, p->p_offset + p->p_filesz);
-                if ((phdr->p_offset >= p->p_offset) && ((phdr->p_offset + phdr->p_filesz) <= (p->p_offset + p->p_filesz))) {
-                    return TRUE;
-                }
-            }
+// Prefetch worker, claims the next window as soon as its ring slot was
+// drained by the writer.
+void *decrypt_thread_func(void *arg)
+{
+    DecryptPipe *dp = (DecryptPipe *)arg;
+    trace_thread("decrypt");
+
+    scePthreadMutexLock(&dp->mutex);
+    while (dp->next < dp->count)
+    {
+        int w = dp->next;
+        if (w >= dp->written + dp->depth)
+        {
+            scePthreadCondWait(&dp->cond, &dp->mutex);
+            continue;
         }
+        dp->next++;
+        scePthreadMutexUnlock(&dp->mutex);
+
+        int res = read_decrypt_window(dp->fd, &dp->windows[w], dp->bufs[w % dp->depth]);
+        stats_io(dp->stats, dp->windows[w].enc ? 2 : 1, dp->windows[w].bytes, 0);
+
+        scePthreadMutexLock(&dp->mutex);
+        dp->ready[w % dp->depth] = res ? 1 : -1;
+        scePthreadCondBroadcast(&dp->cond);
     }
-    return FALSE;
+    scePthreadMutexUnlock(&dp->mutex);
+
+    hist_release();
+    return NULL;
 }
 
-SegmentBufInfo *parse_phdr(Elf64_Phdr *phdrs, int num, int *segBufNum) {
-    printfsocket("segment num : %d\n", num);
+// Pads the output up to the aligned segment size.
+void write_padding(io_file_t *sf, size_t size, uint8_t *buf, size_t bufsz)
+{
+    if (size > 0)
+        memset(buf, 0, (size > bufsz) ? bufsz : size);
+    while (size > 0)
+    {
+        size_t bytes = (size > bufsz) ? bufsz : size;
+        io_write(sf, buf, bytes);
+        size -= bytes;
+    }
+}
+
+// Segments ordered by offset, on equal offsets the larger one first, so a
+// segment contained in another one always comes after it.
+static int segment_before(SegmentBufInfo *a, SegmentBufInfo *b) {
+    if (a->fileoff != b->fileoff)
+        return a->fileoff < b->fileoff;
+    return a->filesz > b->filesz;
+}
+
+static void sift_segment(SegmentBufInfo *infos, int root, int num) {
+    while (root * 2 + 1 < num) {
+        int child = root * 2 + 1;
+        if ((child + 1 < num) && segment_before(&infos[child], &infos[child + 1]))
+            child += 1;
+        if (!segment_before(&infos[root], &infos[child]))
+            return;
+        SegmentBufInfo tmp = infos[root];
+        infos[root] = infos[child];
+        infos[child] = tmp;
+        root = child;
+    }
+}
+
+static void sort_segments(SegmentBufInfo *infos, int num) {
+    for (int i = num / 2 - 1; i >= 0; i -= 1)
+        sift_segment(infos, i, num);
+    for (int i = num - 1; i > 0; i -= 1) {
+        SegmentBufInfo tmp = infos[0];
+        infos[0] = infos[i];
+        infos[i] = tmp;
+        sift_segment(infos, 0, i);
+    }
+}
+
+// Plans the output file: segments sorted by offset, the ones contained in
+// another segment dropped (except the plain 0x6fffff01 ones), and the
+// alignment padding clipped at the start of the next segment, so do_dump()
+// can write the ELF in a single forward pass.
+SegmentBufInfo *parse_phdr(Elf64_Phdr *phdrs, int num, struct self_entry_t *entries, int entnum, uint64_t selfsz, int *segBufNum) {
+    tracesocket("segment num : %d\n", num);
     SegmentBufInfo *infos = (SegmentBufInfo *)malloc(sizeof(SegmentBufInfo) * num);
-    int segindex = 0;
+    int count = 0;
     for (int i = 0; i < num; i += 1) {
         Elf64_Phdr *phdr = &phdrs[i];
         print_phdr(phdr);
 
         if (phdr->p_filesz > 0) {
-            if ((!is_segment_in_other_segment(phdr, i, phdrs, num)) || (phdr->p_type == 0x6fffff01)) {
-                SegmentBufInfo *info = &infos[segindex];
-                segindex += 1;
-                info->index = i;
-                info->bufsz = (phdr->p_filesz + (phdr->p_align - 1)) & (~(phdr->p_align - 1));
-                info->filesz = phdr->p_filesz;
-                info->fileoff = phdr->p_offset;
-                info->enc = (phdr->p_type != 0x6fffff01) ? TRUE : FALSE;
-
-                printfsocket("seg buf info %d -->\n", segindex);
-                printfsocket("    index : %d\n    bufsz : 0x%016llX\n", info->index, info->bufsz);
-                printfsocket("    filesz : 0x%016llX\n    fileoff : 0x%016llX\n", info->filesz, info->fileoff);
+            SegmentBufInfo *info = &infos[count];
+            count += 1;
+            info->index = i;
+            info->type = phdr->p_type;
+            info->bufsz = (phdr->p_filesz + (phdr->p_align - 1)) & (~(phdr->p_align - 1));
+            info->filesz = phdr->p_filesz;
+            info->fileoff = phdr->p_offset;
+            info->pad = 0;
+
+            // Raw segments are read straight from their SELF range, everything
+            // else goes through the decrypting mmap. The version segment has
+            // no entry and is appended at the end of the file.
+            struct self_entry_t *entry = find_self_entry(entries, entnum, i);
+            if (entry) {
+                info->comp = (entry->props & SELF_ENTRY_COMPRESSED) ? TRUE : FALSE;
+                info->enc = (entry->props & (SELF_ENTRY_ENCRYPTED | SELF_ENTRY_COMPRESSED)) ? TRUE : FALSE;
+                info->selfoff = entry->offset;
+                info->selfsz = entry->filesz;
+                if (!info->enc && (info->selfsz < info->filesz))
+                    info->enc = TRUE;
+            }
+            else {
+                info->comp = FALSE;
+                info->enc = (phdr->p_type != SELF_PT_SCE_VERSION) ? TRUE : FALSE;
+                info->selfoff = (selfsz > phdr->p_filesz) ? selfsz - phdr->p_filesz : 0;
+                info->selfsz = phdr->p_filesz;
             }
         }
     }
+
+    sort_segments(infos, count);
+
+    int segindex = 0;
+    uint64_t maxend = 0;
+    for (int i = 0; i < count; i += 1) {
+        SegmentBufInfo *info = &infos[i];
+        uint64_t end = info->fileoff + info->filesz;
+        if ((i == 0) || (end > maxend) || (info->type == SELF_PT_SCE_VERSION)) {
+            infos[segindex] = *info;
+            segindex += 1;
+        }
+        if (end > maxend)
+            maxend = end;
+    }
+
+    for (int i = 0; i < segindex; i += 1) {
+        SegmentBufInfo *info = &infos[i];
+        if (info->enc) {
+            uint64_t end = info->fileoff + info->bufsz;
+            if ((i + 1 < segindex) && (end > infos[i + 1].fileoff))
+                end = infos[i + 1].fileoff;
+            if (end > info->fileoff + info->filesz)
+                info->pad = end - (info->fileoff + info->filesz);
+        }
+
+        tracesocket("seg buf info %d -->\n", i + 1);
+        tracesocket("    index : %d\n    bufsz : 0x%016"PRIx64"\n", info->index, (uint64_t)info->bufsz);
+        tracesocket("    filesz : 0x%016"PRIx64"\n    fileoff : 0x%016"PRIx64"\n", (uint64_t)info->filesz, info->fileoff);
+        tracesocket("    pad : 0x%016"PRIx64"\n", (uint64_t)info->pad);
+        tracesocket("    enc : %d comp : %d selfoff : 0x%016"PRIx64" selfsz : 0x%016"PRIx64"\n", info->enc, info->comp, info->selfoff, (uint64_t)info->selfsz);
+    }
     *segBufNum = segindex;
     return infos;
 }
 
-void do_dump(char *saveFile, int fd, SegmentBufInfo *segBufs, int segBufNum, Elf64_Ehdr *ehdr) {
-    int sf = open(saveFile, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-    if (sf != -1) {
+// Size of the ELF decrypt_self() makes of the SELF whose first bytes are in
+// buf, 0 if buf doesn't hold a complete SELF header.
+uint64_t self_output_size(uint8_t *buf, size_t size, uint64_t selfsz) {
+    if (!is_self_header(buf, size))
+        return 0;
+
+    struct self_header_t *hdr = (struct self_header_t *)buf;
+    struct self_entry_t *entries = (struct self_entry_t *)(buf + sizeof(struct self_header_t));
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)((uint8_t *)entries + hdr->num_entries * sizeof(struct self_entry_t));
+    size_t elfsz = 0x40 + ehdr->e_phnum * sizeof(Elf64_Phdr);
+    if (((uint8_t *)ehdr - buf) + elfsz > size)
+        return 0;
+
+    int segBufNum = 0;
+    SegmentBufInfo *segBufs = parse_phdr((Elf64_Phdr *)((uint8_t *)ehdr + 0x40), ehdr->e_phnum, entries, hdr->num_entries, selfsz, &segBufNum);
+    uint64_t end = elfsz;
+    for (int i = 0; i < segBufNum; i += 1) {
+        if (segBufs[i].fileoff + segBufs[i].filesz + segBufs[i].pad > end)
+            end = segBufs[i].fileoff + segBufs[i].filesz + segBufs[i].pad;
+    }
+    free(segBufs);
+    return end;
+}
+
+void decrypt_bufs_alloc(DecryptBufs *db)
+{
+    db->window = ((size_t)config.decrypt_window * 1024) & ~(DECRYPT_PAGE - 1);
+    if (db->window < DECRYPT_PAGE) db->window = DECRYPT_PAGE;
+    db->depth = (config.decrypt_queue < 2) ? 2 : config.decrypt_queue;
+    db->bufs = (uint8_t **)malloc(sizeof(uint8_t *) * db->depth);
+    for (int i = 0; i < db->depth; i += 1)
+        db->bufs[i] = (uint8_t *)malloc(db->window);
+    db->stats = NULL;
+}
+
+void decrypt_bufs_free(DecryptBufs *db)
+{
+    for (int i = 0; i < db->depth; i += 1)
+        free(db->bufs[i]);
+    free(db->bufs);
+}
+
+// Returns the number of segments that failed, -1 if the output can't be created.
+int do_dump(char *saveFile, int fd, SegmentBufInfo *segBufs, int segBufNum, Elf64_Ehdr *ehdr, DecryptBufs *db) {
+    int errors = 0;
+    io_file_t *sf = io_open(saveFile, 0);
+    stats_io(db->stats, 1, 0, 0);
+    if (sf != NULL) {
         size_t elfsz = 0x40 + ehdr->e_phnum * sizeof(Elf64_Phdr);
-        printfsocket("elf header + phdr size : 0x%08X\n", elfsz);
-        write(sf, ehdr, elfsz);
+        tracesocket("elf header + phdr size : 0x%08X\n", (unsigned int)elfsz);
+        io_write(sf, ehdr, elfsz);
+        stats_io(db->stats, 1, 0, elfsz);
 
+        size_t window = db->window;
+
+        DecryptPipe dp;
+        memset(&dp, 0, sizeof(DecryptPipe));
+        dp.fd = fd;
+        dp.depth = db->depth;
+        dp.bufs = db->bufs;
+        dp.stats = db->stats;
+
+        // Split every segment into windows.
+        for (int i = 0; i < segBufNum; i += 1)
+            dp.count += (segBufs[i].filesz + window - 1) / window;
+        dp.windows = (DecryptWindow *)malloc(sizeof(DecryptWindow) * dp.count);
+        int w = 0;
         for (int i = 0; i < segBufNum; i += 1) {
-            printfsocket("sbuf index : %d, offset : 0x%016x, bufsz : 0x%016x, filesz : 0x%016x, enc : %d\n", segBufs[i].index, segBufs[i].fileoff, segBufs[i].bufsz, segBufs[i].filesz, segBufs[i].enc);
-            uint8_t *buf = (uint8_t*)malloc(segBufs[i].bufsz);
-            memset(buf, 0, segBufs[i].bufsz);
-            if (segBufs[i].enc)
-            {
-                if (read_decrypt_segment(fd, segBufs[i].index, 0, segBufs[i].filesz, buf)) {
-                    lseek(sf, segBufs[i].fileoff, SEEK_SET);
-                    write(sf, buf, segBufs[i].bufsz);
-                }
+            tracesocket("sbuf index : %d, offset : 0x%016"PRIx64", bufsz : 0x%016"PRIx64", filesz : 0x%016"PRIx64", enc : %d\n", segBufs[i].index, segBufs[i].fileoff, (uint64_t)segBufs[i].bufsz, (uint64_t)segBufs[i].filesz, segBufs[i].enc);
+            uint64_t base = segBufs[i].enc ? ((uint64_t)segBufs[i].index << 32) : segBufs[i].selfoff;
+            for (size_t off = 0; off < segBufs[i].filesz; off += window, w += 1) {
+                DecryptWindow *win = &dp.windows[w];
+                win->seg = i;
+                win->enc = segBufs[i].enc;
+                win->offset = base + off;
+                win->outoff = segBufs[i].fileoff + off;
+                win->bytes = (segBufs[i].filesz - off > window) ? window : segBufs[i].filesz - off;
+                win->pad = (off + win->bytes == segBufs[i].filesz) ? segBufs[i].pad : 0;
             }
-            else
-            {
-                lseek(fd, -segBufs[i].filesz, SEEK_END);
-                read(fd, buf, segBufs[i].filesz);
-                lseek(sf, segBufs[i].fileoff, SEEK_SET);
-                write(sf, buf, segBufs[i].filesz);
+        }
+
+        dp.ready = (int *)malloc(sizeof(int) * dp.depth);
+        for (int i = 0; i < dp.depth; i += 1)
+            dp.ready[i] = 0;
+        scePthreadMutexInit(&dp.mutex, NULL, "decrypt");
+        scePthreadCondInit(&dp.cond, NULL, "decrypt");
+
+        int nthreads = (dp.count < DECRYPT_THREADS) ? dp.count : DECRYPT_THREADS;
+        ScePthread threads[DECRYPT_THREADS];
+        for (int i = 0; i < nthreads; i += 1)
+            scePthreadCreate(&threads[i], NULL, decrypt_thread_func, &dp, "decrypt");
+
+        // Drain completed windows in order, a failed window skips the rest
+        // of its segment. Gaps between segments are left as holes.
+        int failed = -1;
+        uint64_t cursor = elfsz;
+        for (w = 0; w < dp.count; w += 1) {
+            DecryptWindow *win = &dp.windows[w];
+            int slot = w % dp.depth;
+
+            scePthreadMutexLock(&dp.mutex);
+            while (!dp.ready[slot])
+                scePthreadCondWait(&dp.cond, &dp.mutex);
+            int res = dp.ready[slot];
+            scePthreadMutexUnlock(&dp.mutex);
+
+            if ((res < 0) && (failed != win->seg)) {
+                failed = win->seg;
+                errors += 1;
+            }
+            if (win->seg != failed) {
+                if (cursor != win->outoff) {
+                    io_seek(sf, win->outoff);
+                    stats_io(db->stats, 1, 0, 0);
+                }
+                io_write(sf, dp.bufs[slot], win->bytes);
+                stats_io(db->stats, 1, 0, win->bytes);
+                if (win->pad) {
+                    write_padding(sf, win->pad, dp.bufs[slot], window);
+                    stats_io(db->stats, (win->pad + window - 1) / window, 0, win->pad);
+                }
+                cursor = win->outoff + win->bytes + win->pad;
             }
-            free(buf);
+
+            scePthreadMutexLock(&dp.mutex);
+            dp.ready[slot] = 0;
+            dp.written += 1;
+            scePthreadCondBroadcast(&dp.cond);
+            scePthreadMutexUnlock(&dp.mutex);
         }
-        close(sf);
+
+        for (int i = 0; i < nthreads; i += 1)
+            scePthreadJoin(threads[i], NULL);
+
+        scePthreadCondDestroy(&dp.cond);
+        scePthreadMutexDestroy(&dp.mutex);
+        free(dp.ready);
+        free(dp.windows);
+        io_close(sf);
+        stats_io(db->stats, 1, 0, 0);
     }
     else {
-        printfsocket("open %s err : %s\n", saveFile, strerror(errno));
+        logsocket(LOG_ERROR, "open %s err : %s\n", saveFile, strerror(errno));
+        errors = -1;
     }
+    return errors;
 }
 
-void decrypt_and_dump_self(char *selfFile, char *saveFile) {
+// Returns 0 on success.
+int decrypt_self(char *selfFile, char *saveFile, DecryptBufs *db) {
+    int res = -1;
     int fd = open(selfFile, O_RDONLY, 0);
+    stats_io(db->stats, 1, 0, 0);
     if (fd != -1) {
         void *addr = mmap(0, 0x4000, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        stats_io(db->stats, 2, 0x4000, 0);
         if (addr != MAP_FAILED) {
-            printfsocket("mmap %s : %p\n", selfFile, addr);
+            tracesocket("mmap %s : %p\n", selfFile, addr);
+
+            struct self_header_t *hdr = (struct self_header_t *)addr;
+            struct self_entry_t *entries = (struct self_entry_t *)((uint8_t*)addr + sizeof(struct self_header_t));
+            Elf64_Ehdr *ehdr = (Elf64_Ehdr *)((uint8_t*)entries + hdr->num_entries * sizeof(struct self_entry_t));
+            tracesocket("ehdr : %p\n", ehdr);
+
+            if (((uint8_t*)ehdr - (uint8_t*)addr) + 0x40 + ehdr->e_phnum * sizeof(Elf64_Phdr) > 0x4000) {
+                logsocket(LOG_ERROR, "self header of %s too large\n", selfFile);
+                munmap(addr, 0x4000);
+                close(fd);
+                return res;
+            }
 
-            uint16_t snum = *(uint16_t*)((uint8_t*)addr + 0x18);
-            Elf64_Ehdr *ehdr = (Elf64_Ehdr *)((uint8_t*)addr + 0x20 + snum * 0x20);
-            printfsocket("ehdr : %p\n", ehdr);
+            for (int i = 0; i < hdr->num_entries; i += 1)
+                print_self_entry(i, &entries[i]);
 
             // shdr fix
             ehdr->e_shoff = ehdr->e_shentsize = ehdr->e_shnum = ehdr->e_shstrndx = 0;
 
             Elf64_Phdr *phdrs = (Elf64_Phdr *)((uint8_t *)ehdr + 0x40);
-            printfsocket("phdrs : %p\n", phdrs);
+            tracesocket("phdrs : %p\n", phdrs);
 
             int segBufNum = 0;
-            SegmentBufInfo *segBufs = parse_phdr(phdrs, ehdr->e_phnum, &segBufNum);
-            do_dump(saveFile, fd, segBufs, segBufNum, ehdr);
+            uint64_t selfsz = lseek(fd, 0, SEEK_END);
+            stats_io(db->stats, 1, 0, 0);
+            SegmentBufInfo *segBufs = parse_phdr(phdrs, ehdr->e_phnum, entries, hdr->num_entries, selfsz, &segBufNum);
+            res = do_dump(saveFile, fd, segBufs, segBufNum, ehdr, db);
             printfsocket("dump completed\n");
 
             free(segBufs);
             munmap(addr, 0x4000);
         }
         else {
-            printfsocket("mmap file %s err : %s\n", selfFile, strerror(errno));
+            logsocket(LOG_ERROR, "mmap file %s err : %s\n", selfFile, strerror(errno));
         }
         close(fd);
+        stats_io(db->stats, 1, 0, 0);
     }
     else {
-        printfsocket("open %s err : %s\n", selfFile, strerror(errno));
+        logsocket(LOG_ERROR, "open %s err : %s\n", selfFile, strerror(errno));
     }
+    return res;
+}
+
+int decrypt_and_dump_self(char *selfFile, char *saveFile) {
+    DecryptBufs db;
+    decrypt_bufs_alloc(&db);
+    int res = decrypt_self(selfFile, saveFile, &db);
+    decrypt_bufs_free(&db);
+    return res;
 }
 
 #define BUFFER_SIZE 65536
@@ -221,26 +562,26 @@ static void copy_file(char *sourcefile, char* destfile)
     int fdin = open(sourcefile, O_RDONLY, 0);
     if (fdin != -1)
     {
-        int fdout = open(destfile, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-        if (fdout != -1)
+        io_file_t *fdout = io_open(destfile, 0);
+        if (fdout != NULL)
         {
-            size_t bytes;
+            ssize_t bytes;
             char *buffer = malloc(BUFFER_SIZE);
             if (buffer != NULL)
             {
                 while (0 < (bytes = read(fdin, buffer, BUFFER_SIZE)))
-                    write(fdout, buffer, bytes);
-                    free(buffer);
+                    io_write(fdout, buffer, bytes);
+                free(buffer);
             }
-            close(fdout);
+            io_close(fdout);
         }
         else {
-            printfsocket("write %s err : %s\n", destfile, strerror(errno));
+            logsocket(LOG_ERROR, "write %s err : %s\n", destfile, strerror(errno));
         }
         close(fdin);
     }
     else {
-        printfsocket("open %s err : %s\n", sourcefile, strerror(errno));
+        logsocket(LOG_ERROR, "open %s err : %s\n", sourcefile, strerror(errno));
     }
 }
 
@@ -250,45 +591,220 @@ static void touch_file(char* destfile)
     if (fd != -1) close(fd);
 }
 
-static void decrypt_dir(char *sourcedir, char* destdir)
+// SDK modules are shared between titles, look them up in the module cache
+// before decrypting.
+int decrypt_self_cached(char *selfFile, char *saveFile, DecryptBufs *db) {
+    cache_key_t key;
+    if (!cache_enabled() || !strstr(selfFile, "/sce_module/") || cache_key(selfFile, &key, db->bufs[0], db->window))
+        return decrypt_self(selfFile, saveFile, db);
+    int reserved;
+    if (!cache_get(&key, saveFile, &reserved, db->bufs[0], db->window))
+        return 0;
+    if (!reserved)
+        return decrypt_self(selfFile, saveFile, db);
+
+    // The key is this job's alone, the module is decrypted into the cache
+    // and published from there. A failed module is decrypted again to the
+    // output.
+    char path[128];
+    cache_path(&key, path);
+    if (!decrypt_self(selfFile, path, db) && !cache_put(&key, saveFile, db->bufs[0], db->window))
+        return 0;
+    cache_drop(&key);
+    return decrypt_self(selfFile, saveFile, db);
+}
+
+typedef struct {
+    char *src;
+    char *dst;
+    int res;
+} DecryptJob;
+
+typedef struct {
+    DecryptJob *jobs;
+    int count;
+    int capacity;
+    int next;
+    int done;
+    int scanned;
+    arena_t paths;
+    ScePthreadMutex mutex;
+    ScePthreadCond cond;
+    stats_t *stats;
+} DecryptQueue;
+
+static void *decrypt_worker_func(void *arg)
+{
+    DecryptQueue *q = (DecryptQueue *)arg;
+    DecryptBufs db;
+    decrypt_bufs_alloc(&db);
+    db.stats = q->stats;
+    trace_thread("decrypt_dir");
+
+    scePthreadMutexLock(&q->mutex);
+    while (1)
+    {
+        if (q->next < q->count)
+        {
+            int i = q->next++;
+            char *src = q->jobs[i].src;
+            char *dst = q->jobs[i].dst;
+            scePthreadMutexUnlock(&q->mutex);
+
+            uint64_t span = trace_begin();
+            int res = decrypt_self_cached(src, dst, &db);
+            trace_end("decrypt_self", span, i);
+            // unpfs left the encrypted file out for this job, keep it
+            // rather than lose the executable.
+            if (res && !config.keep_selfs)
+                copy_file(src, dst);
+            stats_file(q->stats);
+
+            scePthreadMutexLock(&q->mutex);
+            q->jobs[i].res = res;
+            q->done++;
+            char msg[64];
+            sprintf(msg, "%d/%d files completed...", q->done, q->count);
+            notify_set(msg);
+        }
+        else
+        if (q->scanned)
+            break;
+        else
+            scePthreadCondWait(&q->cond, &q->mutex);
+    }
+    scePthreadMutexUnlock(&q->mutex);
+
+    decrypt_bufs_free(&db);
+    hist_release();
+    return NULL;
+}
+
+static void decrypt_enqueue(DecryptQueue *q, char *src, char *dst)
+{
+    scePthreadMutexLock(&q->mutex);
+    if (q->count == q->capacity)
+    {
+        q->capacity = q->capacity ? q->capacity * 2 : 64;
+        q->jobs = realloc(q->jobs, sizeof(DecryptJob) * q->capacity);
+    }
+    DecryptJob *job = &q->jobs[q->count++];
+    job->src = arena_strdup(&q->paths, src);
+    job->dst = arena_strdup(&q->paths, dst);
+    job->res = 0;
+    scePthreadCondSignal(&q->cond);
+    scePthreadMutexUnlock(&q->mutex);
+}
+
+// Walks src and mirrors it in dst, both paths grow and shrink by one
+// component per entry.
+static void scan_dir(DecryptQueue *q, path_t *src, path_t *dst)
 {
     DIR *dir;
     struct dirent *dp;
     struct stat info;
-    char src_path[1024], dst_path[1024];
 
-    dir = opendir(sourcedir);
+    dir = opendir(src->buf);
+    stats_io(q->stats, 1, 0, 0);
     if (!dir)
         return;
 
-    mkdir(destdir, 0777);
+    stats_io(q->stats, io_mkdir(dst->buf), 0, 0);
 
     while ((dp = readdir(dir)) != NULL)
     {
         if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+
+        size_t src_len = path_push(src, dp->d_name);
+        size_t dst_len = path_push(dst, dp->d_name);
+
+        // The entry type normally comes with the dirent, stat only
+        // when the filesystem doesn't fill it in.
+        int type = dp->d_type;
+        if (type == DT_UNKNOWN)
         {
-            // do nothing (straight logic)
+            stats_io(q->stats, 1, 0, 0);
+            if (stat(src->buf, &info))
+                type = DT_UNKNOWN;
+            else
+                type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR)
+        {
+            scan_dir(q, src, dst);
         }
         else
+        if (type == DT_REG)
         {
-            sprintf(src_path, "%s/%s", sourcedir, dp->d_name);
-            sprintf(dst_path, "%s/%s", destdir  , dp->d_name);
-            if (!stat(src_path, &info))
+            if (!(config.skip_assets && is_asset_name(dp->d_name)) && is_self(src->buf, q->stats))
+                decrypt_enqueue(q, src->buf, dst->buf);
+        }
+
+        path_pop(src, src_len);
+        path_pop(dst, dst_len);
+    }
+    closedir(dir);
+    stats_io(q->stats, 1, 0, 0);
+}
+
+#define DECRYPT_JOBS_MAX 8
+
+// Scans the tree and feeds the SELFs it finds to a bounded pool of workers,
+// failures are reported afterwards in scan order.
+static void decrypt_dir(char *sourcedir, char* destdir, stats_t *st)
+{
+    DecryptQueue q;
+    ScePthread workers[DECRYPT_JOBS_MAX];
+    int nworkers = config.decrypt_jobs;
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > DECRYPT_JOBS_MAX) nworkers = DECRYPT_JOBS_MAX;
+
+    memset(&q, 0, sizeof(DecryptQueue));
+    q.stats = st;
+    scePthreadMutexInit(&q.mutex, NULL, "decrypt_dir");
+    scePthreadCondInit(&q.cond, NULL, "decrypt_dir");
+
+    for (int i = 0; i < nworkers; i++)
+        scePthreadCreate(&workers[i], NULL, decrypt_worker_func, &q, "decrypt_dir");
+
+    path_t src, dst;
+    path_init(&src, sourcedir);
+    path_init(&dst, destdir);
+    scan_dir(&q, &src, &dst);
+    path_free(&src);
+    path_free(&dst);
+
+    scePthreadMutexLock(&q.mutex);
+    q.scanned = 1;
+    scePthreadCondBroadcast(&q.cond);
+    scePthreadMutexUnlock(&q.mutex);
+
+    for (int i = 0; i < nworkers; i++)
+        scePthreadJoin(workers[i], NULL);
+
+    int failed = 0;
+    for (int i = 0; i < q.count; i++)
+    {
+        if (q.jobs[i].res != 0)
+        {
+            logsocket(LOG_ERROR, "decrypt %s failed (%d)\n", q.jobs[i].src, q.jobs[i].res);
+            if (!failed)
             {
-                if (S_ISDIR(info.st_mode))
-                {
-                    decrypt_dir(src_path, dst_path);
-                }
-                else
-                if (S_ISREG(info.st_mode))
-                {
-                    if (is_self(src_path))
-                        decrypt_and_dump_self(src_path, dst_path);
-                }
+                char msg[NOTIFY_SIZE + 32];
+                sprintf(msg, "Error: cannot decrypt %.200s!", q.jobs[i].src);
+                notify_post(msg);
             }
+            failed++;
         }
     }
-    closedir(dir);
+    arena_free(&q.paths);
+    notify_clear();
+
+    scePthreadCondDestroy(&q.cond);
+    scePthreadMutexDestroy(&q.mutex);
+    free(q.jobs);
 }
 
 int wait_for_game(char *title_id)
@@ -325,44 +841,21 @@ int wait_for_game(char *title_id)
 
 int wait_for_bdcopy(char *title_id)
 {
-    char path[256];
-    char *buf;
-    size_t filelen, progress;
-
-    sprintf(path, "/system_data/playgo/%s/bdcopy.pbm", title_id);
-    FILE *pbm = fopen(path, "rb");
-    if (!pbm) return 100;
-
-    fseek(pbm, 0, SEEK_END);
-    filelen = ftell(pbm);
-    fseek(pbm, 0, SEEK_SET);
-
-    buf = malloc(filelen);
-
-    fread(buf, sizeof(char), filelen, pbm);
-    fclose(pbm);
-
-    progress = 0;
-    for (int i = 0x100; i < filelen; i++)
-    {
-        if (buf [i]) progress++;
-    }
-
-    free(buf);
-
-    return (progress * 100 / (filelen - 0x100));
+    bdcopy_t bd;
+    int progress = bdcopy_open(&bd, title_id);
+    bdcopy_close(&bd);
+    return progress;
 }
 
 int wait_for_usb(char *usb_name, char *usb_path)
 {
-    int fd = open("/mnt/usb0/.probe", O_WRONLY | O_CREAT | O_TRUNC, 0777);
-    if (fd != -1)
+    for (int i = 0; i < IO_MAX_DEVICES; i++)
     {
-        close(fd);
-        unlink("/mnt/usb0/.probe");
-        sprintf(usb_name, "%s", "USB0");
-        sprintf(usb_path, "%s", "/mnt/usb0");
-        return 1;
+        if (io_probe_usb(i, usb_path))
+        {
+            sprintf(usb_name, "USB%d", i);
+            return 1;
+        }
     }
     return 0;
 }
@@ -378,109 +871,441 @@ int file_exists(char *fname)
     return 0;
 }
 
-void dump_game(char *title_id, char *usb_path)
+enum {
+    STAGE_BDCOPY,
+    STAGE_APP_PKG,
+    STAGE_PATCH_PKG,
+    STAGE_APP_PFS,
+    STAGE_PATCH_PFS,
+    STAGE_APP_SELF,
+    STAGE_PATCH_SELF,
+    STAGE_NUM
+};
+
+typedef struct {
+    char *title_id;
+    char dst_app[80];
+    char dst_pat[80];
+    int merge;
+    bdcopy_t *bd;
+    stats_t stats[STAGE_NUM];
+} DumpJob;
+
+static void copy_appmeta(char *title_id, char *dst)
 {
-    char base_path[64];
     char src_path[64];
     char dst_file[64];
-    char dst_app[64];
-    char dst_pat[64];
-    char dump_sem[64];
-    char comp_sem[64];
 
-    sprintf(base_path, "%s/%s", usb_path, title_id);
+    sprintf(src_path, "/system_data/priv/appmeta/%s/nptitle.dat", title_id);
+    sprintf(dst_file, "%s/sce_sys/nptitle.dat", dst);
+    copy_file(src_path, dst_file);
+    sprintf(src_path, "/system_data/priv/appmeta/%s/npbind.dat", title_id);
+    sprintf(dst_file, "%s/sce_sys/npbind.dat", dst);
+    copy_file(src_path, dst_file);
+}
 
-    sprintf(dump_sem, "%s.dumping", base_path);
-    sprintf(comp_sem, "%s.complete", base_path);
+static void stage_bdcopy(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
 
-    unlink(comp_sem);
-    touch_file(dump_sem);
+    int progress;
+    while ((progress = bdcopy_poll(job->bd)) < 100)
+    {
+        printfsocket("disc copy %d%%, %u blocks/s, %us left\n", progress, job->bd->rate, job->bd->eta);
+        if (bdcopy_stalled(job->bd))
+        {
+            printfsocket("disc copy stalled at %d%%\n", progress);
+            notify_post("Error: the disc copy stopped!");
+            return;
+        }
+        sceKernelSleep(1);
+    }
+    printfsocket("disc copy completed\n");
+}
+
+static void stage_app_pkg(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
+
+    sprintf(src_path, "/user/app/%s/app.pkg", job->title_id);
+    notify("Extracting app package...");
+    unpkg(src_path, job->dst_app, job->bd, &job->stats[STAGE_APP_PKG]);
+    copy_appmeta(job->title_id, job->dst_app);
+}
+
+static void stage_patch_pkg(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
 
+    sprintf(src_path, "/user/patch/%s/patch.pkg", job->title_id);
     if (config.split)
+        notify("Extracting patch package...");
+    else
+        notify("Merging patch package...");
+    unpkg(src_path, job->dst_pat, NULL, &job->stats[STAGE_PATCH_PKG]);
+    copy_appmeta(job->title_id, job->dst_pat);
+}
+
+static void stage_app_pfs(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
+    char pat_path[64];
+
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-app0-nest/pfs_image.dat", job->title_id);
+    if (job->merge)
     {
-        sprintf(dst_app, "%s-app", base_path);
-        sprintf(dst_pat, "%s-patch", base_path);
-        if (config.split & SPLIT_APP)
-            mkdir(dst_app, 0777);
-        if (config.split & SPLIT_PATCH)
-            mkdir(dst_pat, 0777);
+        // Index app and patch images together so files replaced by the patch
+        // are written only once.
+        sprintf(pat_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", job->title_id);
+        notify("Extracting app image\nand applying patch...");
+        unpfs_merge(src_path, pat_path, job->dst_app, job->bd, &job->stats[STAGE_APP_PFS]);
     }
     else
     {
-        sprintf(dst_app, "%s", base_path);
-        sprintf(dst_pat, "%s", base_path);
-        mkdir(base_path, 0777);
+        notify("Extracting app image...");
+        unpfs_merge(src_path, NULL, job->dst_app, job->bd, &job->stats[STAGE_APP_PFS]);
     }
+}
+
+static void stage_patch_pfs(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
+
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", job->title_id);
+    notify("Extracting patch image...");
+    unpfs(src_path, job->dst_pat, &job->stats[STAGE_PATCH_PFS]);
+}
+
+static void stage_app_self(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
+
+    // The mount is only complete with the disc copy.
+    if ((job->bd != NULL) && job->bd->failed)
+        return;
+
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-app0", job->title_id);
+    notify("Decrypting selfs...");
+    decrypt_dir(src_path, job->dst_app, &job->stats[STAGE_APP_SELF]);
+}
+
+static void stage_patch_self(void *arg)
+{
+    DumpJob *job = (DumpJob *)arg;
+    char src_path[64];
+
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0", job->title_id);
+    notify("Decrypting patch...");
+    decrypt_dir(src_path, job->dst_pat, &job->stats[STAGE_PATCH_SELF]);
+}
 
-    if ((!config.split) || (config.split & SPLIT_APP))
+static void stage_init(stage_t *st, const char *name, void (*func)(void *), void *arg, int enabled)
+{
+    memset(st, 0, sizeof(stage_t));
+    st->name = name;
+    st->run = func;
+    st->arg = arg;
+    st->enabled = enabled;
+}
+
+static void stage_dep(stage_t *st, int dep)
+{
+    if (st->ndeps < STAGE_MAX_DEPS)
+        st->deps[st->ndeps++] = dep;
+}
+
+static uint64_t dump_estimate;
+static time_t dump_started;
+
+// What the enabled stages are going to write, from the package tables and
+// the image directories, so it takes a few small reads per file.
+static uint64_t estimate_dump(DumpJob *job, int want_app, int has_pat_pkg, int has_pat_pfs, uint32_t *files)
+{
+    char src_path[64];
+    char pat_path[64];
+    uint64_t total = 0;
+
+    if (want_app)
+    {
+        sprintf(src_path, "/user/app/%s/app.pkg", job->title_id);
+        total += unpkg_estimate(src_path, job->bd, files);
+        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-app0-nest/pfs_image.dat", job->title_id);
+        sprintf(pat_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", job->title_id);
+        total += unpfs_estimate(src_path, job->merge ? pat_path : NULL, job->bd, files);
+    }
+    if (has_pat_pkg)
+    {
+        sprintf(src_path, "/user/patch/%s/patch.pkg", job->title_id);
+        total += unpkg_estimate(src_path, NULL, files);
+    }
+    if (config.split && has_pat_pfs)
+    {
+        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", job->title_id);
+        total += unpfs_estimate(src_path, NULL, NULL, files);
+    }
+    return total;
+}
+
+// Adds the overall progress to a notification, once the estimate is known.
+void dump_progress(char *msg)
+{
+    uint64_t total = dump_estimate;
+    if (total == 0)
+        return;
+
+    uint64_t done = io_written();
+    if (done >= total)
+    {
+        strcat(msg, "\nTotal 99%");
+        return;
+    }
+    uint64_t secs = time(NULL) - dump_started;
+    uint64_t left = (done > 0) ? secs * (total - done) / done : 0;
+    sprintf(msg + strlen(msg), "\nTotal %u%%, %u:%02u left",
+        (uint32_t)(done * 100 / total), (uint32_t)(left / 60), (uint32_t)(left % 60));
+}
+
+static void write_line(int fd, char *line)
+{
+    write(fd, line, strlen(line));
+}
+
+// Machine readable summary of the run next to the .complete marker, to
+// compare runs across titles, firmwares and USB disks. Phases that didn't
+// run are left out.
+static void write_stats(char *base_path, char *title_id, stats_t *total, stats_t *preflight, stats_t *phases, int num, uint64_t estimate)
+{
+    char path[80];
+    char line[320];
+    uint64_t raw, stored;
+    uint32_t mkdirs, mkdirs_skipped;
+
+    sprintf(path, "%s.stats.json", base_path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if (fd == -1)
+        return;
+
+    io_pack_stats(&raw, &stored);
+    sprintf(line, "{\n  \"title\": \"%s\",\n  \"version\": \"%s\",\n  \"devices\": %d,\n  \"archive\": %d,\n  \"compress\": %d,\n  \"network\": %d,\n",
+        title_id, VERSION, io_devices(), config.archive, config.compress, config.net_port != 0);
+    write_line(fd, line);
+    sprintf(line, "  \"estimate\": %"PRIu64",\n  \"written\": %"PRIu64",\n  \"pack\": {\"raw\": %"PRIu64", \"stored\": %"PRIu64"},\n  \"cache\": {\"hits\": %d, \"misses\": %d},\n",
+        estimate, io_written(), raw, stored, cache_hits, cache_misses);
+    write_line(fd, line);
+    io_mkdir_stats(&mkdirs, &mkdirs_skipped);
+    sprintf(line, "  \"mkdir\": {\"calls\": %u, \"skipped\": %u},\n", mkdirs, mkdirs_skipped);
+    write_line(fd, line);
+    write_line(fd, "  \"latency\": [\n    ");
+    for (int i = 0; i < HIST_NUM; i++)
+    {
+        hist_json(line, i);
+        write_line(fd, line);
+        write_line(fd, (i + 1 < HIST_NUM) ? ",\n    " : "\n  ],\n");
+    }
+    write_line(fd, "  \"total\": ");
+    stats_json(line, total);
+    write_line(fd, line);
+    write_line(fd, ",\n  \"phases\": [\n    ");
+    stats_json(line, preflight);
+    write_line(fd, line);
+    for (int i = 0; i < num; i++)
+    {
+        if (phases[i].name == NULL)
+            continue;
+        write_line(fd, ",\n    ");
+        stats_json(line, &phases[i]);
+        write_line(fd, line);
+    }
+    write_line(fd, "\n  ]\n}\n");
+    close(fd);
+}
+
+// Returns 0 once dumped, -1 if the dump can't fit on the USB disk, the
+// disc copy stalled or the output failed.
+int dump_game(char *title_id, char *usb_path)
+{
+    char base_path[64];
+    char src_path[64];
+    char dump_sem[80];
+    char comp_sem[80];
+    char trace_path[80];
+    DumpJob job;
+    bdcopy_t bd;
+    stage_t stages[STAGE_NUM];
+    stats_t total, preflight;
+
+    sprintf(base_path, "%s/%s", usb_path, title_id);
+
+    sprintf(dump_sem, "%s.dumping", base_path);
+    sprintf(comp_sem, "%s.complete", base_path);
+    sprintf(trace_path, "%s.trace.json", base_path);
+
+    unlink(comp_sem);
+    touch_file(dump_sem);
+
+    time_t started = time(NULL);
+    stats_start(&total, "dump");
+    if (config.trace)
+        trace_open();
+    trace_thread("dump");
+    uint64_t span = trace_begin();
+
+    memset(&job, 0, sizeof(DumpJob));
+    job.title_id = title_id;
+
+    int want_app = (!config.split) || (config.split & SPLIT_APP);
+    int want_pat = (!config.split) || (config.split & SPLIT_PATCH);
+
+    sprintf(src_path, "/user/patch/%s/patch.pkg", title_id);
+    int has_pat_pkg = want_pat && file_exists(src_path);
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", title_id);
+    int has_pat_pfs = want_pat && file_exists(src_path);
+    sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0", title_id);
+    int has_pat_dir = want_pat && file_exists(src_path);
+
+    job.merge = !config.split && has_pat_pfs;
+
+    // A disc install may still be copying, the app package and image are
+    // read as far as the copy got, and the app SELFs wait for its end.
+    if (want_app && (bdcopy_open(&bd, title_id) < 100))
     {
+        job.bd = &bd;
         sprintf(src_path, "/user/app/%s/app.pkg", title_id);
-        notify("Extracting app package...");
-        unpkg(src_path, dst_app);
-        sprintf(src_path, "/system_data/priv/appmeta/%s/nptitle.dat", title_id);
-        sprintf(dst_file, "%s/sce_sys/nptitle.dat", dst_app);
-        copy_file(src_path, dst_file);
-        sprintf(src_path, "/system_data/priv/appmeta/%s/npbind.dat", title_id);
-        sprintf(dst_file, "%s/sce_sys/npbind.dat", dst_app);
-        copy_file(src_path, dst_file);
+        bdcopy_locate(&bd, src_path);
     }
 
-    if ((!config.split) || (config.split & SPLIT_PATCH))
+    // Nothing is written before the pre-flight check, a dump that can't fit
+    // stops here. Every file wastes half a cluster on average. Compressed
+    // output is smaller than the estimate by an unknown amount, it only
+    // gets a warning.
+    uint32_t files = 0, bsize;
+    stats_start(&preflight, "preflight");
+    uint64_t preflight_span = trace_begin();
+    uint64_t estimate = estimate_dump(&job, want_app, has_pat_pkg, has_pat_pfs, &files);
+    uint64_t space = io_free_space(usb_path, &bsize);
+    uint64_t need = estimate + (uint64_t)files * bsize / 2;
+    stats_stop(&preflight);
+    trace_end("preflight", preflight_span, files);
+    printfsocket("pre-flight: %u files, %"PRIu64" bytes, %"PRIu64" free\n", files, need, space);
+    if (config.space_check && (space != IO_SPACE_UNKNOWN) && (need > space))
     {
-        sprintf(src_path, "/user/patch/%s/patch.pkg", title_id);
-        if (file_exists(src_path))
+        char msg[96];
+        if (!config.compress)
         {
-            if (config.split)
-                notify("Extracting patch package...");
-            else
-                notify("Merging patch package...");
-            unpkg(src_path, dst_pat);
-            sprintf(src_path, "/system_data/priv/appmeta/%s/nptitle.dat", title_id);
-            sprintf(dst_file, "%s/sce_sys/nptitle.dat", dst_pat);
-            copy_file(src_path, dst_file);
-            sprintf(src_path, "/system_data/priv/appmeta/%s/npbind.dat", title_id);
-            sprintf(dst_file, "%s/sce_sys/npbind.dat", dst_pat);
-            copy_file(src_path, dst_file);
+            sprintf(msg, "Not enough space on USB disk\n%u MB needed, %u MB free", (uint32_t)(need >> 20), (uint32_t)(space >> 20));
+            notify(msg);
+            if (want_app)
+                bdcopy_close(&bd);
+            trace_close(trace_path);
+            unlink(dump_sem);
+            return -1;
         }
+        sprintf(msg, "Dump may not fit on USB disk\n%u MB uncompressed, %u MB free", (uint32_t)(need >> 20), (uint32_t)(space >> 20));
+        notify(msg);
     }
+    dump_started = started;
+    dump_estimate = estimate;
 
-    if ((!config.split) || (config.split & SPLIT_APP))
+    hist_open();
+    cache_open(usb_path);
+    io_init(usb_path, title_id, config.io_writers);
+    if (io_devices() > 1)
     {
-        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-app0-nest/pfs_image.dat", title_id);
-        notify("Extracting app image...");
-        unpfs(src_path, dst_app);
+        char msg[64];
+        sprintf(msg, "Writing to %d USB disks", io_devices());
+        notify(msg);
     }
 
-    if ((!config.split) || (config.split & SPLIT_PATCH))
+    if (config.split)
     {
-        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0-nest/pfs_image.dat", title_id);
-        if (file_exists(src_path))
-        {
-            if (config.split)
-                notify("Extracting patch image...");
-            else
-                notify("Applying patch...");
-            unpfs(src_path, dst_pat);
-        }
+        sprintf(job.dst_app, "%s-app", base_path);
+        sprintf(job.dst_pat, "%s-patch", base_path);
+        if (config.split & SPLIT_APP)
+            io_mkdir(job.dst_app);
+        if (config.split & SPLIT_PATCH)
+            io_mkdir(job.dst_pat);
+    }
+    else
+    {
+        sprintf(job.dst_app, "%s", base_path);
+        sprintf(job.dst_pat, "%s", base_path);
+        io_mkdir(base_path);
     }
 
-    if ((!config.split) || (config.split & SPLIT_APP))
+    // Package, image and SELF extraction of app and patch only meet where they
+    // write the same files, everything else runs side by side. Images are not
+    // written over SELFs (those are left to the decrypt stages), so the SELF
+    // stages don't wait for them. When merging, the patch goes after the app.
+    stage_init(&stages[STAGE_BDCOPY],     "bdcopy",     stage_bdcopy,     &job, job.bd != NULL);
+    stage_init(&stages[STAGE_APP_PKG],    "app_pkg",    stage_app_pkg,    &job, want_app);
+    stage_init(&stages[STAGE_PATCH_PKG],  "patch_pkg",  stage_patch_pkg,  &job, has_pat_pkg);
+    stage_init(&stages[STAGE_APP_PFS],    "app_pfs",    stage_app_pfs,    &job, want_app);
+    stage_init(&stages[STAGE_PATCH_PFS],  "patch_pfs",  stage_patch_pfs,  &job, config.split && has_pat_pfs);
+    stage_init(&stages[STAGE_APP_SELF],   "app_self",   stage_app_self,   &job, want_app);
+    stage_init(&stages[STAGE_PATCH_SELF], "patch_self", stage_patch_self, &job, has_pat_dir);
+    for (int i = 0; i < STAGE_NUM; i++)
+        stages[i].stats = &job.stats[i];
+
+    stage_dep(&stages[STAGE_APP_PFS], STAGE_APP_PKG);
+    stage_dep(&stages[STAGE_APP_SELF], STAGE_BDCOPY);
+    stage_dep(&stages[STAGE_PATCH_PFS], STAGE_PATCH_PKG);
+    if (!config.split)
     {
-        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-app0", title_id);
-        notify("Decrypting selfs...");
-        decrypt_dir(src_path, dst_app);
+        stage_dep(&stages[STAGE_PATCH_PKG], STAGE_APP_PKG);
+        stage_dep(&stages[STAGE_APP_PFS], STAGE_PATCH_PKG);
+        stage_dep(&stages[STAGE_PATCH_SELF], STAGE_APP_SELF);
     }
 
-    if ((!config.split) || (config.split & SPLIT_PATCH))
+    stage_run_all(stages, STAGE_NUM);
+    dump_estimate = 0;
+    // Output that didn't make it to the pack, the stream or the disk leaves
+    // the dump incomplete, as does a stalled disc copy.
+    int failed = io_fini();
+
+    stats_stop(&total);
+    stats_sum(&total, &preflight);
+    for (int i = 0; i < STAGE_NUM; i++)
+        stats_sum(&total, &job.stats[i]);
+
+    uint64_t raw, stored;
+    io_pack_stats(&raw, &stored);
+    if (raw > 0)
     {
-        sprintf(src_path, "/mnt/sandbox/pfsmnt/%s-patch0", title_id);
-        if (file_exists(src_path))
-        {
-            notify("Decrypting patch...");
-            decrypt_dir(src_path, dst_pat);
-        }
+        char msg[NOTIFY_SIZE];
+        uint64_t secs = time(NULL) - started;
+        if (secs < 1) secs = 1;
+        snprintf(msg, sizeof(msg), "Packed to %u%% of %u MB\n%u MB/s effective, %u MB/s written",
+            (uint32_t)(stored * 100 / raw), (uint32_t)(raw >> 20),
+            (uint32_t)((raw / secs) >> 20), (uint32_t)((stored / secs) >> 20));
+        notify(msg);
     }
 
+    if ((job.bd != NULL) && bd.failed)
+        failed = -1;
+    if (want_app)
+        bdcopy_close(&bd);
+
+    if (cache_enabled() && (cache_hits + cache_misses))
+    {
+        char msg[64];
+        sprintf(msg, "Module cache: %d of %d hits", cache_hits, cache_hits + cache_misses);
+        notify(msg);
+    }
+    cache_close();
+
+    write_stats(base_path, title_id, &total, &preflight, job.stats, STAGE_NUM, estimate);
+    hist_close();
+    trace_end("dump", span, 0);
+    trace_close(trace_path);
+
     unlink(dump_sem);
+    if (failed)
+        return -1;
     touch_file(comp_sem);
+    return 0;
 }
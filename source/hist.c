@@ -0,0 +1,159 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "hist.h"
+
+// One table per live recording thread, handed on to the next thread once
+// its owner gives it back. Threads past HIST_THREADS at a time share the
+// extra last table and update it atomically.
+typedef struct {
+    int taken;
+    ScePthread owner;
+    uint64_t max[HIST_NUM];
+    uint32_t count[HIST_NUM][HIST_BUCKETS];
+} HistTable;
+
+static const char *hist_names[HIST_NUM] = { "pfs_read", "pkg_read", "self_read", "write" };
+
+static HistTable *hist_tables;
+// Tables below this were claimed at some point, the rest are untouched.
+static uint32_t hist_used;
+
+void hist_open(void)
+{
+    hist_tables = malloc(sizeof(HistTable) * (HIST_THREADS + 1));
+    if (hist_tables != NULL)
+        memset(hist_tables, 0, sizeof(HistTable) * (HIST_THREADS + 1));
+    hist_used = 0;
+}
+
+// Values below 8 us get a bucket each, above that 8 buckets share every
+// power of two.
+static int hist_bucket(uint64_t us)
+{
+    if (us < 8)
+        return us;
+    int e = 63 - __builtin_clzll(us);
+    int b = ((e - 2) << 3) | ((us >> (e - 3)) & 7);
+    return (b < HIST_BUCKETS) ? b : HIST_BUCKETS - 1;
+}
+
+// Largest value that falls into bucket b.
+static uint64_t hist_upper(int b)
+{
+    if (b < 8)
+        return b;
+    int e = (b >> 3) + 2;
+    return ((uint64_t)(9 + (b & 7)) << (e - 3)) - 1;
+}
+
+// Finds the table of the calling thread, claiming a free one on its first
+// record. The owner is written after the claim, a thread scanning in
+// between can't match it as it only looks for itself.
+static HistTable *hist_table(void)
+{
+    ScePthread self = scePthreadSelf();
+    uint32_t used = __atomic_load_n(&hist_used, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < used; i++)
+        if (__atomic_load_n(&hist_tables[i].taken, __ATOMIC_ACQUIRE) && (__atomic_load_n(&hist_tables[i].owner, __ATOMIC_RELAXED) == self))
+            return &hist_tables[i];
+
+    for (uint32_t i = 0; i < HIST_THREADS; i++)
+    {
+        int free = 0;
+        if (!__atomic_compare_exchange_n(&hist_tables[i].taken, &free, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+        __atomic_store_n(&hist_tables[i].owner, self, __ATOMIC_RELAXED);
+        while ((used < i + 1) && !__atomic_compare_exchange_n(&hist_used, &used, i + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            ;
+        return &hist_tables[i];
+    }
+    return &hist_tables[HIST_THREADS];
+}
+
+// Records the time since start, taken with stats_now().
+void hist_record(int op, uint64_t start)
+{
+    if (hist_tables == NULL)
+        return;
+    uint64_t us = stats_now() - start;
+    int b = hist_bucket(us);
+    HistTable *t = hist_table();
+    if (t != &hist_tables[HIST_THREADS])
+    {
+        t->count[op][b]++;
+        if (us > t->max[op])
+            t->max[op] = us;
+        return;
+    }
+
+    __atomic_add_fetch(&t->count[op][b], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&t->max[op], __ATOMIC_RELAXED);
+    while ((us > max) && !__atomic_compare_exchange_n(&t->max[op], &max, us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// Gives the table of the calling thread back, its counts stay for
+// hist_json(). Threads that record call this before they exit.
+void hist_release(void)
+{
+    if (hist_tables == NULL)
+        return;
+    ScePthread self = scePthreadSelf();
+    uint32_t used = __atomic_load_n(&hist_used, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < used; i++)
+    {
+        if (__atomic_load_n(&hist_tables[i].taken, __ATOMIC_ACQUIRE) && (__atomic_load_n(&hist_tables[i].owner, __ATOMIC_RELAXED) == self))
+        {
+            __atomic_store_n(&hist_tables[i].owner, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&hist_tables[i].taken, 0, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+static uint64_t hist_percentile(uint32_t *count, uint64_t total, uint32_t permille)
+{
+    uint64_t rank = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += count[b];
+        if ((seen > 0) && (seen >= rank))
+            return hist_upper(b);
+    }
+    return 0;
+}
+
+// One operation as a JSON object, the tables of all threads merged.
+int hist_json(char *buf, int op)
+{
+    uint32_t count[HIST_BUCKETS];
+    uint64_t total = 0, max = 0;
+
+    memset(count, 0, sizeof(count));
+    if (hist_tables != NULL)
+    {
+        for (int i = 0; i <= HIST_THREADS; i++)
+        {
+            for (int b = 0; b < HIST_BUCKETS; b++)
+                count[b] += hist_tables[i].count[op][b];
+            if (hist_tables[i].max[op] > max)
+                max = hist_tables[i].max[op];
+        }
+    }
+    for (int b = 0; b < HIST_BUCKETS; b++)
+        total += count[b];
+
+    uint64_t p50 = hist_percentile(count, total, 500);
+    uint64_t p99 = hist_percentile(count, total, 990);
+    uint64_t p999 = hist_percentile(count, total, 999);
+    return sprintf(buf, "{\"op\": \"%s\", \"count\": %"PRIu64", \"p50_us\": %"PRIu64", \"p99_us\": %"PRIu64", \"p999_us\": %"PRIu64", \"max_us\": %"PRIu64"}",
+        hist_names[op], total, (p50 < max) ? p50 : max, (p99 < max) ? p99 : max, (p999 < max) ? p999 : max, max);
+}
+
+void hist_close(void)
+{
+    free(hist_tables);
+    hist_tables = NULL;
+}
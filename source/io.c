@@ -0,0 +1,800 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "main.h"
+#include "lz4.h"
+#include "io.h"
+#include "trace.h"
+#include "hist.h"
+#include "notify.h"
+#include "arena.h"
+
+// Output layer. Every extracted file goes through io_open()/io_write(), so
+// the dump can be spread over several USB disks: whole files are placed on
+// the disk with the fewest bytes assigned so far and a placement map is
+// left next to the dump for tool/stripe_merge.
+//
+// Alternatively the whole dump is streamed into a single TITLE_ID.pack,
+// which saves the directory and FAT updates of every small file. Writes are
+// gathered in a staging buffer and go out in IO_PACK_STAGE sized blocks,
+// tool/unpack turns the pack back into a tree. With compression on, every
+// writer thread compresses its own blocks before they enter the staging
+// buffer, so compression runs as parallel as the extraction itself.
+//
+// The pack stream can also be sent to a PC over TCP instead of the USB
+// disk, `unpack -l` receives it there.
+//
+// Each disk has its own write budget, at most the configured number of
+// writes are in flight per disk so that stages running in parallel don't
+// thrash it while the other disks are busy too.
+//
+// Directories are made once per dump. Every stage asks for the same ones
+// again (each prefix of each package path, the tree the SELF stage mirrors
+// over the extracted image), and on FAT each of those is a directory
+// search on the disk. A set of the directories made so far answers them.
+
+static char io_root[64];
+static size_t io_rootlen;
+static char io_prefix[64];
+static size_t io_prefixlen;
+static char io_paths[IO_MAX_DEVICES][64];
+static uint64_t io_assigned[IO_MAX_DEVICES];
+// Write slots of a device are handed out in the order they were asked
+// for: a writer takes the next ticket and goes once that many slots have
+// been granted, so a stage that writes back to back can't take a slot it
+// just gave back ahead of the others waiting for it.
+static uint64_t io_tickets[IO_MAX_DEVICES];
+static uint64_t io_granted[IO_MAX_DEVICES];
+static int io_ndevs;
+static int io_map = -1;
+static ScePthreadMutex io_mutex;
+static ScePthreadCond io_cond;
+static int io_ready;
+
+static int io_pack = -1;
+static int io_net;
+static int io_failed;
+static uint64_t io_flushed;
+static uint8_t *io_stage;
+static size_t io_staged;
+static struct io_pack_entry_t *io_entries;
+static char **io_names;
+static uint32_t io_count, io_capacity;
+static ScePthreadMutex io_pack_mutex;
+static size_t io_zblock;
+static int io_zaccel;
+static uint64_t io_raw, io_stored;
+static uint64_t io_total;
+
+// Where each striped file went, under io_mutex. A file written again goes
+// back to the same disk, so no disk is left with an older copy of it.
+typedef struct {
+    int dev;
+    uint64_t size;
+    char rel[];
+} io_place_t;
+
+static io_place_t **io_places;
+static uint32_t io_place_count, io_place_size;
+static arena_t io_place_names;
+
+static ScePthreadMutex io_dir_mutex;
+static char **io_dirs;
+static uint32_t io_dir_count, io_dir_size;
+static arena_t io_dir_names;
+static uint32_t io_mkdir_calls, io_mkdir_skipped;
+
+// Override to probe stand-in mount points.
+#ifndef IO_USB_PATH
+#define IO_USB_PATH "/mnt/usb%d"
+#endif
+
+int io_probe_usb(int index, char *path)
+{
+    char probe[64];
+
+    sprintf(path, IO_USB_PATH, index);
+    sprintf(probe, "%s/.probe", path);
+    int fd = open(probe, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if (fd == -1)
+        return 0;
+    close(fd);
+    unlink(probe);
+    return 1;
+}
+
+// Leading fields of the kernel's struct statfs, the rest is room for what
+// it fills in after them.
+struct io_statfs_t
+{
+    uint32_t version;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t bsize;
+    uint64_t iosize;
+    uint64_t blocks;
+    uint64_t bfree;
+    int64_t bavail;
+    uint8_t rest[0x200];
+};
+
+// Free space on the disks io_init() is going to write to, and the block
+// size of the first one. Network output has no limit known up front.
+uint64_t io_free_space(char *usb_path, uint32_t *bsize)
+{
+    struct io_statfs_t st;
+    char path[64];
+    uint64_t total = 0;
+
+    *bsize = 0;
+    if (config.net_port)
+        return IO_SPACE_UNKNOWN;
+    if (syscall(396, usb_path, &st))
+        return IO_SPACE_UNKNOWN;
+    *bsize = st.bsize;
+    if (st.bavail > 0)
+        total += st.bavail * st.bsize;
+
+    if (config.stripe && !config.archive && !config.compress)
+    {
+        for (int i = 0; i < IO_MAX_DEVICES; i++)
+        {
+            if (io_probe_usb(i, path) && strcmp(path, usb_path) && !syscall(396, path, &st) && (st.bavail > 0))
+                total += st.bavail * st.bsize;
+        }
+    }
+    return total;
+}
+
+static int io_connect(void)
+{
+    struct sockaddr_in server;
+
+    server.sin_len = sizeof(server);
+    server.sin_family = AF_INET;
+    sceNetInetPton(AF_INET, config.net_host, &server.sin_addr);
+    server.sin_port = sceNetHtons(config.net_port);
+    memset(server.sin_zero, 0, sizeof(server.sin_zero));
+
+    int s = sceNetSocket("dump", AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+        return -1;
+    if (sceNetConnect(s, (struct sockaddr *)&server, sizeof(server)) < 0)
+    {
+        sceNetSocketClose(s);
+        return -1;
+    }
+
+    int size = IO_PACK_STAGE;
+    sceNetSetsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *)&size, sizeof(int));
+    return s;
+}
+
+void io_init(char *usb_path, char *title_id, int writers)
+{
+    char path[80];
+
+    if (writers < 1)
+        writers = 1;
+
+    sprintf(io_root, "%s", usb_path);
+    io_rootlen = strlen(io_root);
+    sprintf(io_prefix, "%s/%s", usb_path, title_id);
+    io_prefixlen = strlen(io_prefix);
+
+    io_ndevs = 0;
+    sprintf(io_paths[io_ndevs++], "%s", usb_path);
+    if (config.stripe)
+    {
+        for (int i = 0; (i < IO_MAX_DEVICES) && (io_ndevs < IO_MAX_DEVICES); i++)
+        {
+            if (io_probe_usb(i, path) && strcmp(path, usb_path))
+                sprintf(io_paths[io_ndevs++], "%s", path);
+        }
+    }
+    for (int i = 0; i < io_ndevs; i++)
+    {
+        io_assigned[i] = 0;
+        io_tickets[i] = 0;
+        io_granted[i] = writers;
+        printfsocket("io device %d: %s\n", i, io_paths[i]);
+    }
+
+    io_map = -1;
+    io_pack = -1;
+    io_raw = io_stored = 0;
+    io_total = 0;
+    io_zblock = 0;
+    if (config.compress)
+    {
+        io_zblock = (size_t)config.compress_block * 1024;
+        if (io_zblock < 0x1000) io_zblock = 0x1000;
+        if (io_zblock > IO_PACK_STAGE) io_zblock = IO_PACK_STAGE;
+        io_zaccel = 10 - config.compress_level;
+        if (io_zaccel < 1) io_zaccel = 1;
+        if (io_zaccel > 9) io_zaccel = 9;
+    }
+    io_net = 0;
+    io_failed = 0;
+    io_flushed = 0;
+    if (config.net_port)
+    {
+        io_pack = io_connect();
+        if (io_pack != -1)
+            io_net = 1;
+        else
+        {
+            char msg[64];
+            sprintf(msg, "Can't connect to %s:%d\nDumping to USB...", config.net_host, config.net_port);
+            notify(msg);
+        }
+    }
+    if ((io_pack == -1) && (config.archive || config.compress))
+    {
+        sprintf(path, "%s.pack", io_prefix);
+        io_pack = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    }
+    if (io_pack != -1)
+    {
+        struct io_pack_header_t header = { IO_PACK_MAGIC, 0, 0 };
+        io_stage = malloc(IO_PACK_STAGE);
+        memcpy(io_stage, &header, sizeof(header));
+        io_staged = sizeof(header);
+        io_count = 0;
+        scePthreadMutexInit(&io_pack_mutex, NULL, "io_pack");
+        io_ndevs = 1;
+    }
+    else
+    if (io_ndevs > 1)
+    {
+        sprintf(path, "%s.stripe", io_prefix);
+        io_map = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+        for (int i = 0; (io_map != -1) && (i < io_ndevs); i++)
+        {
+            char line[96];
+            snprintf(line, sizeof(line), "D %d %.63s\n", i, io_paths[i]);
+            write(io_map, line, strlen(line));
+        }
+    }
+
+    io_places = NULL;
+    io_place_count = io_place_size = 0;
+    arena_init(&io_place_names);
+    io_dirs = NULL;
+    io_dir_count = io_dir_size = 0;
+    arena_init(&io_dir_names);
+    io_mkdir_calls = io_mkdir_skipped = 0;
+    scePthreadMutexInit(&io_dir_mutex, NULL, "io_dir");
+
+    scePthreadMutexInit(&io_mutex, NULL, "io");
+    scePthreadCondInit(&io_cond, NULL, "io");
+    io_ready = 1;
+}
+
+static void io_pack_flush(void)
+{
+    uint64_t span = trace_begin();
+    size_t done = 0;
+    while (!io_failed && (done < io_staged))
+    {
+        ssize_t res;
+        uint64_t started = stats_now();
+        if (io_net)
+            res = sceNetSend(io_pack, io_stage + done, io_staged - done, 0);
+        else
+            res = write(io_pack, io_stage + done, io_staged - done);
+        hist_record(HIST_WRITE, started);
+        if (res <= 0)
+        {
+            printfsocket("pack write failed at 0x%"PRIx64"\n", io_flushed + done);
+            notify_post(io_net ? "Error: network transfer failed!" : "Error: writing the pack failed!");
+            io_failed = 1;
+            break;
+        }
+        done += res;
+    }
+    io_flushed += io_staged;
+    trace_end("pack_flush", span, io_staged);
+    io_staged = 0;
+}
+
+// Appends to the staging buffer, flushing every time it fills up.
+static void io_pack_put(const void *buf, size_t size)
+{
+    while (size > 0)
+    {
+        size_t bytes = IO_PACK_STAGE - io_staged;
+        if (bytes > size) bytes = size;
+        memcpy(io_stage + io_staged, buf, bytes);
+        io_staged += bytes;
+        buf = (const uint8_t *)buf + bytes;
+        size -= bytes;
+        if (io_staged == IO_PACK_STAGE)
+            io_pack_flush();
+    }
+}
+
+static int io_pack_add(const char *rel, uint32_t type)
+{
+    scePthreadMutexLock(&io_pack_mutex);
+    if (io_count == io_capacity)
+    {
+        io_capacity = io_capacity ? io_capacity * 2 : 256;
+        io_entries = realloc(io_entries, sizeof(struct io_pack_entry_t) * io_capacity);
+        io_names = realloc(io_names, sizeof(char *) * io_capacity);
+    }
+    int id = io_count++;
+    io_entries[id].size = 0;
+    io_entries[id].type = type;
+    io_entries[id].namelen = strlen(rel);
+    io_names[id] = malloc(io_entries[id].namelen + 1);
+    strcpy(io_names[id], rel);
+
+    struct io_pack_record_t record = { id, io_entries[id].namelen, 0, type, IO_CODEC_ENTRY };
+    io_pack_put(&record, sizeof(record));
+    io_pack_put(rel, record.len);
+    scePthreadMutexUnlock(&io_pack_mutex);
+    return id;
+}
+
+// Writes the index and the trailer.
+static void io_pack_close(void)
+{
+    struct io_pack_record_t end = { 0, 0, 0, 0, IO_CODEC_END };
+    io_pack_put(&end, sizeof(end));
+
+    struct io_pack_header_t trailer = { IO_PACK_MAGIC, io_count, io_flushed + io_staged };
+
+    for (uint32_t i = 0; i < io_count; i++)
+    {
+        io_pack_put(&io_entries[i], sizeof(struct io_pack_entry_t));
+        io_pack_put(io_names[i], io_entries[i].namelen);
+        free(io_names[i]);
+    }
+    io_pack_put(&trailer, sizeof(trailer));
+    io_pack_flush();
+    if (io_net)
+        sceNetSocketClose(io_pack);
+    else
+        close(io_pack);
+    io_pack = -1;
+
+    printfsocket("pack: %u entries, %"PRIu64" bytes\n", io_count, io_flushed);
+
+    free(io_stage);
+    free(io_entries);
+    free(io_names);
+    io_stage = NULL;
+    io_entries = NULL;
+    io_names = NULL;
+    io_count = io_capacity = 0;
+    scePthreadMutexDestroy(&io_pack_mutex);
+}
+
+// Returns -1 if anything the dump wrote didn't make it to the output.
+int io_fini(void)
+{
+    if (!io_ready)
+        return 0;
+    io_ready = 0;
+    if (io_pack != -1)
+        io_pack_close();
+    if (io_map != -1)
+        close(io_map);
+    io_map = -1;
+    scePthreadCondDestroy(&io_cond);
+    scePthreadMutexDestroy(&io_mutex);
+    scePthreadMutexDestroy(&io_dir_mutex);
+    free(io_places);
+    io_places = NULL;
+    arena_free(&io_place_names);
+    free(io_dirs);
+    io_dirs = NULL;
+    arena_free(&io_dir_names);
+    return io_failed ? -1 : 0;
+}
+
+int io_devices(void)
+{
+    return io_ready ? io_ndevs : 1;
+}
+
+// Files of the dump are plain files at the path they were opened with.
+int io_direct(void)
+{
+    return (io_devices() == 1) && (io_pack == -1);
+}
+
+// FNV-1a over the path.
+static uint32_t io_hash(const char *s)
+{
+    uint32_t h = 0x811C9DC5;
+    while (*s)
+    {
+        h ^= (uint8_t)*s++;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+// The set of directories made, under io_dir_mutex.
+static int io_dir_find(const char *path)
+{
+    if (io_dir_size == 0)
+        return 0;
+    uint32_t h = io_hash(path) & (io_dir_size - 1);
+    while (io_dirs[h] != NULL)
+    {
+        if (!strcmp(io_dirs[h], path))
+            return 1;
+        h = (h + 1) & (io_dir_size - 1);
+    }
+    return 0;
+}
+
+static void io_dir_insert(char **table, uint32_t size, char *name)
+{
+    uint32_t h = io_hash(name) & (size - 1);
+    while (table[h] != NULL)
+        h = (h + 1) & (size - 1);
+    table[h] = name;
+}
+
+// Returns 1 if the directory was made before in this dump.
+static int io_dir_known(const char *path)
+{
+    if (!io_ready)
+        return 0;
+    scePthreadMutexLock(&io_dir_mutex);
+    int known = io_dir_find(path);
+    if (known)
+        io_mkdir_skipped++;
+    scePthreadMutexUnlock(&io_dir_mutex);
+    return known;
+}
+
+// A directory goes into the set only once it exists, a thread asking for
+// it in the meantime makes it again instead of going ahead without it.
+static void io_dir_add(const char *path)
+{
+    if (!io_ready)
+        return;
+    scePthreadMutexLock(&io_dir_mutex);
+    if (!io_dir_find(path))
+    {
+        if ((io_dir_count + 1) * 2 > io_dir_size)
+        {
+            uint32_t size = io_dir_size ? io_dir_size * 2 : 256;
+            char **table = malloc(sizeof(char *) * size);
+            memset(table, 0, sizeof(char *) * size);
+            for (uint32_t i = 0; i < io_dir_size; i++)
+                if (io_dirs[i] != NULL)
+                    io_dir_insert(table, size, io_dirs[i]);
+            free(io_dirs);
+            io_dirs = table;
+            io_dir_size = size;
+        }
+        io_dir_insert(io_dirs, io_dir_size, arena_strdup(&io_dir_names, path));
+        io_dir_count++;
+    }
+    scePthreadMutexUnlock(&io_dir_mutex);
+}
+
+static io_place_t *io_place_find(const char *rel)
+{
+    if (io_place_size == 0)
+        return NULL;
+    uint32_t h = io_hash(rel) & (io_place_size - 1);
+    while (io_places[h] != NULL)
+    {
+        if (!strcmp(io_places[h]->rel, rel))
+            return io_places[h];
+        h = (h + 1) & (io_place_size - 1);
+    }
+    return NULL;
+}
+
+static void io_place_insert(io_place_t **table, uint32_t size, io_place_t *place)
+{
+    uint32_t h = io_hash(place->rel) & (size - 1);
+    while (table[h] != NULL)
+        h = (h + 1) & (size - 1);
+    table[h] = place;
+}
+
+static io_place_t *io_place_add(const char *rel, int dev)
+{
+    if ((io_place_count + 1) * 2 > io_place_size)
+    {
+        uint32_t size = io_place_size ? io_place_size * 2 : 256;
+        io_place_t **table = malloc(sizeof(io_place_t *) * size);
+        memset(table, 0, sizeof(io_place_t *) * size);
+        for (uint32_t i = 0; i < io_place_size; i++)
+            if (io_places[i] != NULL)
+                io_place_insert(table, size, io_places[i]);
+        free(io_places);
+        io_places = table;
+        io_place_size = size;
+    }
+    io_place_t *place = arena_alloc(&io_place_names, sizeof(io_place_t) + strlen(rel) + 1);
+    place->dev = dev;
+    place->size = 0;
+    strcpy(place->rel, rel);
+    io_place_insert(io_places, io_place_size, place);
+    io_place_count++;
+    return place;
+}
+
+// An existing directory counts as made.
+static int io_mkdir_now(const char *path)
+{
+    uint64_t span = trace_begin();
+    int res = mkdir(path, 0777);
+    trace_end("mkdir", span, 0);
+    __atomic_add_fetch(&io_mkdir_calls, 1, __ATOMIC_RELAXED);
+    if ((res == 0) || (errno == EEXIST))
+        io_dir_add(path);
+    return res;
+}
+
+// Creates the parent directories of a file placed on another disk.
+static void io_mkdirs(char *path)
+{
+    for (char *p = path + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = 0;
+            if (!io_dir_known(path))
+                io_mkdir_now(path);
+            *p = '/';
+        }
+    }
+}
+
+io_file_t *io_open(const char *path, uint64_t size)
+{
+    io_file_t *f = malloc(sizeof(io_file_t));
+    memset(f, 0, sizeof(io_file_t));
+
+    int inside = io_ready && !strncmp(path, io_prefix, io_prefixlen);
+    if (inside && (io_pack != -1))
+    {
+        f->fd = io_pack;
+        f->id = io_pack_add(path + io_rootlen + 1, IO_PACK_FILE);
+        return f;
+    }
+    f->id = -1;
+    if (inside && (io_ndevs > 1))
+    {
+        const char *rel = path + io_rootlen + 1;
+
+        // A file written before replaces its copy, whatever the disks hold.
+        scePthreadMutexLock(&io_mutex);
+        io_place_t *place = io_place_find(rel);
+        if (place != NULL)
+        {
+            f->dev = place->dev;
+            io_assigned[f->dev] -= place->size;
+            place->size = 0;
+        }
+        else
+        {
+            for (int i = 1; i < io_ndevs; i++)
+            {
+                if (io_assigned[i] < io_assigned[f->dev])
+                    f->dev = i;
+            }
+            io_place_add(rel, f->dev);
+        }
+        io_assigned[f->dev] += size;
+        scePthreadMutexUnlock(&io_mutex);
+
+        f->hint = size;
+        f->rel = malloc(strlen(rel) + 1);
+        strcpy(f->rel, rel);
+
+        if (f->dev)
+        {
+            char *devpath = malloc(strlen(io_paths[f->dev]) + strlen(rel) + 2);
+            sprintf(devpath, "%s/%s", io_paths[f->dev], rel);
+            io_mkdirs(devpath);
+            f->fd = open(devpath, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+            free(devpath);
+        }
+        else
+            f->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    }
+    else
+        f->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+
+    if (f->fd == -1)
+    {
+        if (f->rel)
+        {
+            scePthreadMutexLock(&io_mutex);
+            io_assigned[f->dev] -= size;
+            scePthreadMutexUnlock(&io_mutex);
+        }
+        free(f->rel);
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+static ssize_t io_pack_write(io_file_t *f, const void *buf, size_t size)
+{
+    struct io_pack_record_t record;
+    size_t block = io_zblock ? io_zblock : IO_PACK_STAGE;
+    size_t left = size;
+
+    while (left > 0)
+    {
+        size_t bytes = (left > block) ? block : left;
+        const void *data = buf;
+
+        record.id = f->id;
+        record.len = bytes;
+        record.offset = f->pos;
+        record.raw = bytes;
+        record.codec = IO_CODEC_STORED;
+
+        // Compressed outside the lock, blocks that don't shrink by at
+        // least 1/16 are stored.
+        if (io_zblock && (f->zfails < IO_COMPRESS_TRIES))
+        {
+            if (!f->zbuf)
+            {
+                f->zbuf = malloc(LZ4_BOUND(io_zblock));
+                f->ztable = malloc(LZ4_TABLE_SIZE);
+            }
+            size_t len = lz4_compress(buf, bytes, f->zbuf, bytes - bytes / 16, f->ztable, io_zaccel);
+            if (len)
+            {
+                record.len = len;
+                record.codec = IO_CODEC_LZ4;
+                data = f->zbuf;
+                f->zfails = 0;
+            }
+            else
+                f->zfails++;
+        }
+
+        scePthreadMutexLock(&io_pack_mutex);
+        io_pack_put(&record, sizeof(record));
+        io_pack_put(data, record.len);
+        io_raw += bytes;
+        io_stored += record.len;
+        if (f->pos + bytes > io_entries[f->id].size)
+            io_entries[f->id].size = f->pos + bytes;
+        scePthreadMutexUnlock(&io_pack_mutex);
+
+        buf = (const uint8_t *)buf + bytes;
+        left -= bytes;
+        f->pos += bytes;
+    }
+
+    f->written += size;
+    return io_failed ? -1 : (ssize_t)size;
+}
+
+void io_pack_stats(uint64_t *raw, uint64_t *stored)
+{
+    *raw = io_raw;
+    *stored = io_stored;
+}
+
+// Raw bytes written so far by the dump, for the overall progress.
+uint64_t io_written(void)
+{
+    return __atomic_load_n(&io_total, __ATOMIC_RELAXED);
+}
+
+ssize_t io_write(io_file_t *f, const void *buf, size_t size)
+{
+    if (f->id >= 0)
+    {
+        ssize_t res = io_pack_write(f, buf, size);
+        if (res > 0) __atomic_add_fetch(&io_total, res, __ATOMIC_RELAXED);
+        return res;
+    }
+
+    if (!io_ready)
+    {
+        ssize_t res = write(f->fd, buf, size);
+        if (res > 0) f->written += res;
+        return res;
+    }
+
+    scePthreadMutexLock(&io_mutex);
+    uint64_t ticket = io_tickets[f->dev]++;
+    while (ticket >= io_granted[f->dev])
+        scePthreadCondWait(&io_cond, &io_mutex);
+    scePthreadMutexUnlock(&io_mutex);
+
+    uint64_t started = stats_now();
+    ssize_t res = write(f->fd, buf, size);
+    hist_record(HIST_WRITE, started);
+    if (res > 0)
+    {
+        f->written += res;
+        __atomic_add_fetch(&io_total, res, __ATOMIC_RELAXED);
+    }
+    if (res != (ssize_t)size)
+        io_failed = 1;
+
+    scePthreadMutexLock(&io_mutex);
+    io_granted[f->dev]++;
+    scePthreadCondBroadcast(&io_cond);
+    scePthreadMutexUnlock(&io_mutex);
+
+    return res;
+}
+
+int io_seek(io_file_t *f, uint64_t offset)
+{
+    if (f->id >= 0)
+    {
+        f->pos = offset;
+        return 0;
+    }
+    return (lseek(f->fd, offset, SEEK_SET) == (off_t)offset) ? 0 : -1;
+}
+
+int io_close(io_file_t *f)
+{
+    if (f->id >= 0)
+    {
+        free(f->zbuf);
+        free(f->ztable);
+        free(f);
+        return 0;
+    }
+
+    int res = close(f->fd);
+
+    if (f->rel)
+    {
+        char line[32];
+        sprintf(line, "F %d %"PRIu64" ", f->dev, f->written);
+
+        scePthreadMutexLock(&io_mutex);
+        io_assigned[f->dev] += f->written - f->hint;
+        io_place_find(f->rel)->size = f->written;
+        if (io_map != -1)
+        {
+            write(io_map, line, strlen(line));
+            write(io_map, f->rel, strlen(f->rel));
+            write(io_map, "\n", 1);
+        }
+        scePthreadMutexUnlock(&io_mutex);
+
+        free(f->rel);
+    }
+    free(f);
+
+    return res;
+}
+
+// Returns 1 if a mkdir was issued, 0 if the directory was known or went
+// into the pack, for the callers' syscall counts.
+int io_mkdir(const char *path)
+{
+    if (io_dir_known(path))
+        return 0;
+    if (io_ready && (io_pack != -1) && !strncmp(path, io_prefix, io_prefixlen))
+    {
+        io_pack_add(path + io_rootlen + 1, IO_PACK_DIR);
+        io_dir_add(path);
+        return 0;
+    }
+    io_mkdir_now(path);
+    return 1;
+}
+
+void io_mkdir_stats(uint32_t *calls, uint32_t *skipped)
+{
+    *calls = io_mkdir_calls;
+    *skipped = io_mkdir_skipped;
+}
@@ -0,0 +1,127 @@
+#include "ps4.h"
+#include "defines.h"
+#include "lz4.h"
+
+// LZ4 block compressor, greedy single hash table like LZ4_compress_fast().
+// The output is a plain LZ4 block, tool/unpack decodes it.
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5
+#define MFLIMIT       12
+#define MAX_DISTANCE  0xFFFF
+
+typedef uint32_t u32_una __attribute__((aligned(1), may_alias));
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    return *(const u32_una *)p;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *put_literals(uint8_t *op, uint8_t *token, const uint8_t *src, size_t len)
+{
+    if (len >= 15)
+    {
+        *token = 15 << 4;
+        op = put_length(op, len - 15);
+    }
+    else
+        *token = (uint8_t)(len << 4);
+    memcpy(op, src, len);
+    return op + len;
+}
+
+// Returns the compressed size, 0 if it doesn't fit in cap. A larger accel
+// skips ahead faster over data that doesn't match.
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap, uint32_t *table, int accel)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + size;
+    const uint8_t *mflimit = end - MFLIMIT;
+    const uint8_t *matchlimit = end - LAST_LITERALS;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+
+    if (accel < 1)
+        accel = 1;
+
+    if (size > MFLIMIT)
+    {
+        memset(table, 0, LZ4_TABLE_SIZE);
+        unsigned misses = 0;
+        ip++;
+        while (ip < mflimit)
+        {
+            uint32_t h = hash32(read32(ip));
+            const uint8_t *ref = src + table[h];
+            table[h] = ip - src;
+
+            if ((ref >= ip) || (ip - ref > MAX_DISTANCE) || (read32(ref) != read32(ip)))
+            {
+                ip += accel + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while ((ip > anchor) && (ref > src) && (ip[-1] == ref[-1]))
+            {
+                ip--;
+                ref--;
+            }
+            const uint8_t *m = ip + MIN_MATCH;
+            const uint8_t *r = ref + MIN_MATCH;
+            while ((m < matchlimit) && (*m == *r))
+            {
+                m++;
+                r++;
+            }
+
+            size_t lit = ip - anchor;
+            size_t mlen = m - ip - MIN_MATCH;
+            if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 + 1 + LAST_LITERALS > oend)
+                return 0;
+
+            uint8_t *token = op++;
+            op = put_literals(op, token, anchor, lit);
+            uint16_t dist = (uint16_t)(ip - ref);
+            *op++ = dist & 0xFF;
+            *op++ = dist >> 8;
+            if (mlen >= 15)
+            {
+                *token |= 15;
+                op = put_length(op, mlen - 15);
+            }
+            else
+                *token |= (uint8_t)mlen;
+
+            ip = m;
+            anchor = ip;
+            if (ip < mflimit)
+                table[hash32(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    size_t lit = end - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend)
+        return 0;
+    uint8_t *token = op++;
+    op = put_literals(op, token, anchor, lit);
+
+    return op - dst;
+}
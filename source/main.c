@@ -4,8 +4,9 @@
 #include "debug.h"
 #include "dump.h"
 #include "cfg.h"
+#include "notify.h"
+#include "probe.h"
 
-int nthread_run;
 configuration config;
 
 unsigned int long long __readmsr(unsigned long __register) {
@@ -153,28 +154,6 @@ int kpayload(struct thread *td){
 	return 0;
 }
 
-void *nthread_func(void *arg)
-{
-        time_t t1, t2;
-        t1 = 0;
-	while (nthread_run)
-	{
-		if (notify_buf[0])
-		{
-			t2 = time(NULL);
-			if ((t2 - t1) >= config.notify)
-			{
-				t1 = t2;
-				notify(notify_buf);
-			}
-		}
-		else t1 = 0;
-		sceKernelSleep(1);
-	}
-
-	return NULL;
-}
-
 static int config_handler(void* user, const char* name, const char* value)
 {
     configuration* pconfig = (configuration*)user;
@@ -188,6 +167,64 @@ static int config_handler(void* user, const char* name, const char* value)
     } else
     if (MATCH("shutdown")) {
         pconfig->shutdown = atoi(value);
+    } else
+    if (MATCH("keep_selfs")) {
+        pconfig->keep_selfs = atoi(value);
+    } else
+    if (MATCH("decrypt_queue")) {
+        pconfig->decrypt_queue = atoi(value);
+    } else
+    if (MATCH("decrypt_window")) {
+        pconfig->decrypt_window = atoi(value);
+        pconfig->manual |= CFG_DECRYPT_WINDOW;
+    } else
+    if (MATCH("decrypt_jobs")) {
+        pconfig->decrypt_jobs = atoi(value);
+    } else
+    if (MATCH("cache_size")) {
+        pconfig->cache_size = atoi(value);
+    } else
+    if (MATCH("skip_assets")) {
+        pconfig->skip_assets = atoi(value);
+    } else
+    if (MATCH("io_writers")) {
+        pconfig->io_writers = atoi(value);
+        pconfig->manual |= CFG_IO_WRITERS;
+    } else
+    if (MATCH("stripe")) {
+        pconfig->stripe = atoi(value);
+    } else
+    if (MATCH("archive")) {
+        pconfig->archive = atoi(value);
+        pconfig->manual |= CFG_ARCHIVE;
+    } else
+    if (MATCH("compress")) {
+        pconfig->compress = atoi(value);
+        pconfig->manual |= CFG_COMPRESS;
+    } else
+    if (MATCH("compress_block")) {
+        pconfig->compress_block = atoi(value);
+    } else
+    if (MATCH("compress_level")) {
+        pconfig->compress_level = atoi(value);
+    } else
+    if (MATCH("net_host")) {
+        sprintf(pconfig->net_host, "%.15s", value);
+    } else
+    if (MATCH("net_port")) {
+        pconfig->net_port = atoi(value);
+    } else
+    if (MATCH("space_check")) {
+        pconfig->space_check = atoi(value);
+    } else
+    if (MATCH("trace")) {
+        pconfig->trace = atoi(value);
+    } else
+    if (MATCH("usb_probe")) {
+        pconfig->usb_probe = atoi(value);
+    } else
+    if (MATCH("usb_probe_save")) {
+        pconfig->usb_probe_save = atoi(value);
     };
 
     return 1;
@@ -220,55 +257,81 @@ int _main(struct thread *td)
 	config.split    = 3;
 	config.notify   = 60;
 	config.shutdown = 1;
-
-	nthread_run = 1;
-	notify_buf[0] = '\0';
-	ScePthread nthread;
-	scePthreadCreate(&nthread, NULL, nthread_func, NULL, "nthread");
+	config.keep_selfs = 0;
+	config.decrypt_queue  = 4;
+	config.decrypt_window = 1024;
+	config.decrypt_jobs   = 2;
+	config.cache_size     = 0;
+	config.skip_assets    = 1;
+	config.io_writers     = 2;
+	config.stripe         = 0;
+	config.archive        = 0;
+	config.compress       = 0;
+	config.compress_block = 256;
+	config.compress_level = 5;
+	config.net_host[0]    = '\0';
+	config.net_port       = 0;
+	config.space_check    = 1;
+	config.trace          = 0;
+	config.usb_probe      = 1;
+	config.usb_probe_save = 0;
+
+	notify_start(dump_progress);
 
 	notify("Welcome to PS4-DUMPER v"VERSION);
 	sceKernelSleep(5);
 
 	if (!wait_for_usb(usb_name, usb_path))
 	{
-		sprintf(notify_buf, "Waiting for USB disk...");
+		notify_set("Waiting for USB disk...");
 		do {
 			sceKernelSleep(1);
 		}
 		while (!wait_for_usb(usb_name, usb_path));
-		notify_buf[0] = '\0';
+		notify_clear();
 	}
 
 	sprintf(cfg_path, "%s/dumper.cfg", usb_path);
 	cfg_parse(cfg_path, config_handler, &config);
 
+	if (config.usb_probe)
+		usb_probe(usb_path, cfg_path);
+
+#ifndef DEBUG_SOCKET
+	if (config.net_port)
+		initNetwork();
+#endif
+
 	if (!wait_for_game(title_id))
 	{
-		sprintf(notify_buf, "Waiting for game to launch...");
+		notify_set("Waiting for game to launch...");
 		do {
 			sceKernelSleep(1);
 		}
 		while (!wait_for_game(title_id));
-		notify_buf[0] = '\0';
+		notify_clear();
 	}
 
-	if (wait_for_bdcopy(title_id) < 100)
+	// Disc installs are dumped while they copy, files that are already on
+	// the HDD go first.
+	progress = wait_for_bdcopy(title_id);
+	if (progress < 100)
 	{
-		do {
-			sceKernelSleep(1);
-			progress = wait_for_bdcopy(title_id);
-			sprintf(notify_buf, "Waiting for game to copy\n%u%% completed...", progress);
-		}
-		while (progress < 100);
-		notify_buf[0] = '\0';
+		sprintf(msg, "Game is still copying (%u%%)\nDumping copied files first...", progress);
+		notify(msg);
+		sceKernelSleep(5);
 	}
 
 	sprintf(msg, "Start dumping\n%s to %s", title_id, usb_name);
 	notify(msg);
 	sceKernelSleep(5);
 
-	dump_game(title_id, usb_path);
-
+	if (dump_game(title_id, usb_path))
+	{
+		sprintf(msg, "%s not dumped.\nBye!", title_id);
+		config.shutdown = 0;
+	}
+	else
 	if (config.shutdown)
 		sprintf(msg, "%s dumped.\nShutting down...", title_id);
 	else
@@ -276,7 +339,7 @@ int _main(struct thread *td)
 	notify(msg);
 	sceKernelSleep(10);
 
-	nthread_run = 0;
+	notify_stop();
 
 	printfsocket("Bye!");
 
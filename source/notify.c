@@ -0,0 +1,189 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "main.h"
+#include "stats.h"
+#include "notify.h"
+
+// The progress text is a seqlock: a producer makes the sequence odd,
+// copies the text and makes it even again, the thread copies it out and
+// retries if the sequence moved meanwhile. A producer that finds another
+// one writing skips its update, the next one is never far away. Only
+// progress starting or stopping and posted messages take the mutex.
+
+static char notify_text[NOTIFY_SIZE];
+static uint32_t notify_seq;
+
+static char notify_queue[NOTIFY_QUEUE][NOTIFY_SIZE];
+static int notify_head;
+static int notify_count;
+static int notify_changed;
+static int notify_run;
+
+static void (*notify_decorate)(char *msg);
+static ScePthread notify_thread;
+static ScePthreadMutex notify_mutex;
+static ScePthreadCond notify_cond;
+
+static void notify_wake(void)
+{
+    if (!notify_run)
+        return;
+    scePthreadMutexLock(&notify_mutex);
+    notify_changed = 1;
+    scePthreadCondSignal(&notify_cond);
+    scePthreadMutexUnlock(&notify_mutex);
+}
+
+static void notify_publish(const char *msg, int wait)
+{
+    uint32_t seq = __atomic_load_n(&notify_seq, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        if (!(seq & 1) && __atomic_compare_exchange_n(&notify_seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (!wait)
+            return;
+        scePthreadYield();
+        seq = __atomic_load_n(&notify_seq, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    int was_set = (notify_text[0] != '\0');
+    strncpy(notify_text, msg, NOTIFY_SIZE - 1);
+    notify_text[NOTIFY_SIZE - 1] = '\0';
+    int is_set = (notify_text[0] != '\0');
+
+    __atomic_store_n(&notify_seq, seq + 2, __ATOMIC_RELEASE);
+
+    if (was_set != is_set)
+        notify_wake();
+}
+
+// Never blocks, called from the copy loops.
+void notify_set(const char *msg)
+{
+    notify_publish(msg, 0);
+}
+
+// Stopping progress must not get lost, it waits for a concurrent update.
+void notify_clear(void)
+{
+    notify_publish("", 1);
+}
+
+// Queues a message to be shown right away, a full queue drops it.
+void notify_post(const char *msg)
+{
+    if (!notify_run)
+        return;
+    scePthreadMutexLock(&notify_mutex);
+    if (notify_count < NOTIFY_QUEUE)
+    {
+        char *slot = notify_queue[(notify_head + notify_count) % NOTIFY_QUEUE];
+        strncpy(slot, msg, NOTIFY_SIZE - 1);
+        slot[NOTIFY_SIZE - 1] = '\0';
+        notify_count++;
+        scePthreadCondSignal(&notify_cond);
+    }
+    scePthreadMutexUnlock(&notify_mutex);
+}
+
+static void notify_snapshot(char *msg)
+{
+    for (;;)
+    {
+        uint32_t seq = __atomic_load_n(&notify_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            scePthreadYield();
+            continue;
+        }
+        memcpy(msg, notify_text, NOTIFY_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&notify_seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+    msg[NOTIFY_SIZE - 1] = '\0';
+}
+
+// Progress that just started is shown at once, then once per interval.
+// Messages still queued are sent before the thread ends.
+static void *notify_thread_func(void *arg)
+{
+    char msg[NOTIFY_SIZE + 32];
+    uint64_t shown = 0;
+
+    scePthreadMutexLock(&notify_mutex);
+    while (notify_run || (notify_count > 0))
+    {
+        if (notify_count > 0)
+        {
+            strcpy(msg, notify_queue[notify_head]);
+            notify_head = (notify_head + 1) % NOTIFY_QUEUE;
+            notify_count--;
+            scePthreadMutexUnlock(&notify_mutex);
+            notify(msg);
+            scePthreadMutexLock(&notify_mutex);
+            continue;
+        }
+
+        int changed = notify_changed;
+        notify_changed = 0;
+        notify_snapshot(msg);
+        if (changed)
+            shown = 0;
+
+        if ((msg[0] == '\0') || !config.notify)
+        {
+            while (notify_run && !notify_changed && (notify_count == 0))
+                scePthreadCondWait(&notify_cond, &notify_mutex);
+            continue;
+        }
+
+        uint64_t now = stats_now();
+        uint64_t interval = (uint64_t)config.notify * 1000000;
+        if ((shown == 0) || (now - shown >= interval))
+        {
+            shown = now;
+            scePthreadMutexUnlock(&notify_mutex);
+            if (notify_decorate != NULL)
+                notify_decorate(msg);
+            notify(msg);
+            scePthreadMutexLock(&notify_mutex);
+            continue;
+        }
+
+        if (notify_run && !notify_changed && (notify_count == 0))
+            scePthreadCondTimedwait(&notify_cond, &notify_mutex, interval - (now - shown));
+    }
+    scePthreadMutexUnlock(&notify_mutex);
+
+    return NULL;
+}
+
+// decorate appends to the progress text before it is shown, msg has room
+// for 32 more characters.
+void notify_start(void (*decorate)(char *msg))
+{
+    notify_decorate = decorate;
+    notify_text[0] = '\0';
+    notify_head = 0;
+    notify_count = 0;
+    notify_changed = 0;
+    scePthreadMutexInit(&notify_mutex, NULL, "notify");
+    scePthreadCondInit(&notify_cond, NULL, "notify");
+    notify_run = 1;
+    scePthreadCreate(&notify_thread, NULL, notify_thread_func, NULL, "notify");
+}
+
+void notify_stop(void)
+{
+    scePthreadMutexLock(&notify_mutex);
+    notify_run = 0;
+    scePthreadCondSignal(&notify_cond);
+    scePthreadMutexUnlock(&notify_mutex);
+    scePthreadJoin(notify_thread, NULL);
+    scePthreadCondDestroy(&notify_cond);
+    scePthreadMutexDestroy(&notify_mutex);
+}
@@ -0,0 +1,60 @@
+#include "ps4.h"
+#include "defines.h"
+#include "path.h"
+
+static void path_grow(path_t *p, size_t need)
+{
+    if (need <= p->cap)
+        return;
+    size_t cap = p->cap ? p->cap : 256;
+    while (cap < need)
+        cap *= 2;
+    p->buf = realloc(p->buf, cap);
+    p->cap = cap;
+}
+
+void path_init(path_t *p, const char *base)
+{
+    p->buf = NULL;
+    p->len = 0;
+    p->cap = 0;
+    path_grow(p, strlen(base) + 1);
+    strcpy(p->buf, base);
+    p->len = strlen(base);
+}
+
+// An empty component leaves the path as it is, an empty path gets no
+// separator, like the relative names of an image.
+size_t path_pushn(path_t *p, const char *name, size_t n)
+{
+    size_t len = p->len;
+    if (n == 0)
+        return len;
+    int sep = (len > 0);
+    path_grow(p, len + sep + n + 1);
+    if (sep)
+        p->buf[p->len++] = '/';
+    memcpy(p->buf + p->len, name, n);
+    p->len += n;
+    p->buf[p->len] = '\0';
+    return len;
+}
+
+size_t path_push(path_t *p, const char *name)
+{
+    return path_pushn(p, name, strlen(name));
+}
+
+void path_pop(path_t *p, size_t len)
+{
+    p->len = len;
+    p->buf[len] = '\0';
+}
+
+void path_free(path_t *p)
+{
+    free(p->buf);
+    p->buf = NULL;
+    p->len = 0;
+    p->cap = 0;
+}
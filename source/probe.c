@@ -0,0 +1,226 @@
+#include "types.h"
+#include "libc.h"
+#include "probe.h"
+
+// The measurements and the profile, plain C over a probe_io_t. The
+// payload's side is in probe_io.c.
+
+static const uint32_t probe_chunks[PROBE_CHUNKS] = { 0x10000, 0x40000, 0x100000 };
+static const uint32_t probe_depths[PROBE_DEPTHS] = { 1, 2, 4 };
+
+typedef struct {
+    const probe_io_t *io;
+    char path[80];
+    const uint8_t *buf;
+    uint32_t chunk;
+    uint64_t bytes;
+    int res;
+} ProbeWriter;
+
+static uint32_t probe_rate(uint64_t bytes, uint64_t us)
+{
+    return (uint32_t)(bytes * 1000000 / 1024 / (us ? us : 1));
+}
+
+// Synced before closing, so it's the disk that is measured and not the
+// kernel's cache.
+static void *probe_writer(void *arg)
+{
+    ProbeWriter *w = (ProbeWriter *)arg;
+    const probe_io_t *io = w->io;
+    w->res = -1;
+    int fd = io->open(w->path, 1);
+    if (fd == -1)
+        return NULL;
+    uint64_t left = w->bytes;
+    while (left > 0)
+    {
+        size_t bytes = (left > w->chunk) ? w->chunk : left;
+        if (io->write(fd, w->buf, bytes) != (ssize_t)bytes)
+        {
+            io->close(fd);
+            return NULL;
+        }
+        left -= bytes;
+    }
+    io->sync(fd);
+    io->close(fd);
+    w->res = 0;
+    return NULL;
+}
+
+// PROBE_BYTES split over depth writers, KiB/s or 0 if a write failed.
+// With keep the first file stays for probe_read().
+static uint32_t probe_write(const char *dir, const probe_io_t *io, const uint8_t *buf, uint32_t chunk, uint32_t depth, int keep)
+{
+    ProbeWriter w[4];
+    void *args[4];
+    int ok = 1;
+
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        w[i].io = io;
+        sprintf(w[i].path, "%s/.probe%u", dir, i);
+        w[i].buf = buf;
+        w[i].chunk = chunk;
+        w[i].bytes = PROBE_BYTES / depth;
+        args[i] = &w[i];
+    }
+    uint64_t start = io->now();
+    io->parallel(probe_writer, args, depth);
+    uint64_t us = io->now() - start;
+
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        if (w[i].res != 0)
+            ok = 0;
+        if (!keep || (i > 0))
+            io->unlink(w[i].path);
+    }
+    return ok ? probe_rate(PROBE_BYTES, us) : 0;
+}
+
+// Reads back the file of the last probe_write() and checks it, a disk
+// that doesn't give back what was written is fake or failing.
+static void probe_read(const char *dir, const probe_io_t *io, const uint8_t *buf, uint32_t chunk, probe_t *p)
+{
+    char path[80];
+    uint64_t done = 0;
+
+    sprintf(path, "%s/.probe0", dir);
+    p->verified = 0;
+    uint8_t *back = malloc(chunk);
+    int fd = io->open(path, 0);
+    if ((fd != -1) && (back != NULL))
+    {
+        uint64_t start = io->now();
+        p->verified = 1;
+        while (done < PROBE_BYTES)
+        {
+            if ((io->read(fd, back, chunk) != (ssize_t)chunk) || memcmp(back, buf, chunk))
+            {
+                p->verified = 0;
+                break;
+            }
+            done += chunk;
+        }
+        p->read_rate = probe_rate(done, io->now() - start);
+    }
+    if (fd != -1)
+        io->close(fd);
+    free(back);
+    io->unlink(path);
+}
+
+// Small files, what extracting a title with many of them costs.
+static void probe_files(const char *dir, const probe_io_t *io, const uint8_t *buf, probe_t *p)
+{
+    char path[80];
+    uint32_t created = 0;
+
+    uint64_t start = io->now();
+    for (uint32_t i = 0; i < PROBE_FILES; i++)
+    {
+        sprintf(path, "%s/.probe_f%u", dir, i);
+        int fd = io->open(path, 1);
+        if (fd == -1)
+            break;
+        io->write(fd, buf, 0x1000);
+        io->close(fd);
+        created++;
+    }
+    uint64_t us = io->now() - start;
+    p->file_rate = (uint32_t)((uint64_t)created * 1000000 / (us ? us : 1));
+
+    for (uint32_t i = 0; i < created; i++)
+    {
+        sprintf(path, "%s/.probe_f%u", dir, i);
+        io->unlink(path);
+    }
+}
+
+// Returns -1 if dir can't be written.
+int usb_probe_measure(const char *dir, const probe_io_t *io, probe_t *p)
+{
+    uint32_t max = probe_chunks[PROBE_CHUNKS - 1];
+    uint8_t *buf = malloc(max);
+    if (buf == NULL)
+        return -1;
+    for (uint32_t i = 0; i < max; i++)
+        buf[i] = (uint8_t)(i * 131 + (i >> 12) + 7);
+
+    memset(p, 0, sizeof(probe_t));
+    int best = 0;
+    for (int i = 0; i < PROBE_CHUNKS; i++)
+    {
+        p->chunk[i] = probe_chunks[i];
+        p->chunk_rate[i] = probe_write(dir, io, buf, probe_chunks[i], 1, i == PROBE_CHUNKS - 1);
+        if (p->chunk_rate[i] == 0)
+        {
+            free(buf);
+            return -1;
+        }
+        if (p->chunk_rate[i] > p->chunk_rate[best])
+            best = i;
+    }
+    probe_read(dir, io, buf, max, p);
+
+    for (int i = 0; i < PROBE_DEPTHS; i++)
+    {
+        p->depth[i] = probe_depths[i];
+        if (probe_depths[i] == 1)
+            p->depth_rate[i] = p->chunk_rate[best];
+        else
+            p->depth_rate[i] = probe_write(dir, io, buf, p->chunk[best], probe_depths[i], 0);
+    }
+    probe_files(dir, io, buf, p);
+
+    free(buf);
+    return 0;
+}
+
+// Rates within 5% count as equal. Of those the largest chunk wins, fewer
+// windows to decrypt, and the fewest writers, less seeking between files.
+void usb_probe_pick(const probe_t *p, int level, probe_profile_t *out)
+{
+    uint32_t best = 0;
+    for (int i = 0; i < PROBE_CHUNKS; i++)
+        if (p->chunk_rate[i] > best)
+            best = p->chunk_rate[i];
+    for (int i = PROBE_CHUNKS - 1; i >= 0; i--)
+    {
+        if ((uint64_t)p->chunk_rate[i] * 20 >= (uint64_t)best * 19)
+        {
+            out->decrypt_window = p->chunk[i] / 1024;
+            break;
+        }
+    }
+
+    uint32_t best_depth = 0;
+    for (int i = 0; i < PROBE_DEPTHS; i++)
+        if (p->depth_rate[i] > best_depth)
+            best_depth = p->depth_rate[i];
+    for (int i = 0; i < PROBE_DEPTHS; i++)
+    {
+        if ((uint64_t)p->depth_rate[i] * 20 >= (uint64_t)best_depth * 19)
+        {
+            out->io_writers = p->depth[i];
+            break;
+        }
+    }
+    if (best_depth > best)
+        best = best_depth;
+
+    // A disk slower than LZ4 gains from writing less, one slow at
+    // creating files from writing a single pack.
+    out->archive = 0;
+    out->compress = 0;
+    if (level >= 2)
+    {
+        if (best < PROBE_SLOW_WRITE)
+            out->compress = 1;
+        else
+        if (p->file_rate < PROBE_SLOW_FILES)
+            out->archive = 1;
+    }
+}
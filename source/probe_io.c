@@ -0,0 +1,146 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "main.h"
+#include "stats.h"
+#include "notify.h"
+#include "probe.h"
+
+// The payload's side of the USB probe: the file calls, threads and clock
+// for usb_probe_measure(), and applying the profile to the configuration.
+
+static int probe_ps4_open(const char *path, int write)
+{
+    return write ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777) : open(path, O_RDONLY, 0);
+}
+
+static ssize_t probe_ps4_read(int fd, void *buf, size_t size)
+{
+    return read(fd, buf, size);
+}
+
+static ssize_t probe_ps4_write(int fd, const void *buf, size_t size)
+{
+    return write(fd, buf, size);
+}
+
+static void probe_ps4_sync(int fd)
+{
+    syscall(95, fd);
+}
+
+static void probe_ps4_close(int fd)
+{
+    close(fd);
+}
+
+static void probe_ps4_unlink(const char *path)
+{
+    unlink(path);
+}
+
+// The first call runs on this thread.
+static void probe_ps4_parallel(void *(*fn)(void *), void **args, int num)
+{
+    ScePthread threads[4];
+    for (int i = 1; i < num; i++)
+        scePthreadCreate(&threads[i], NULL, fn, args[i], "probe");
+    fn(args[0]);
+    for (int i = 1; i < num; i++)
+        scePthreadJoin(threads[i], NULL);
+}
+
+static const probe_io_t probe_ps4_io = {
+    probe_ps4_open,
+    probe_ps4_read,
+    probe_ps4_write,
+    probe_ps4_sync,
+    probe_ps4_close,
+    probe_ps4_unlink,
+    stats_now,
+    probe_ps4_parallel,
+};
+
+static void probe_save(char *cfg_path, const probe_t *p, int keys)
+{
+    char line[128];
+    int fd = open(cfg_path, O_WRONLY | O_APPEND, 0);
+    if (fd == -1)
+        return;
+    sprintf(line, "\n; Picked by usb_probe: %u KiB/s written, %u files/s\n", p->depth_rate[0], p->file_rate);
+    write(fd, line, strlen(line));
+    if (keys & CFG_DECRYPT_WINDOW)
+    {
+        sprintf(line, "decrypt_window=%d\n", config.decrypt_window);
+        write(fd, line, strlen(line));
+    }
+    if (keys & CFG_IO_WRITERS)
+    {
+        sprintf(line, "io_writers=%d\n", config.io_writers);
+        write(fd, line, strlen(line));
+    }
+    if (keys & CFG_ARCHIVE)
+    {
+        sprintf(line, "archive=%d\n", config.archive);
+        write(fd, line, strlen(line));
+    }
+    if (keys & CFG_COMPRESS)
+    {
+        sprintf(line, "compress=%d\n", config.compress);
+        write(fd, line, strlen(line));
+    }
+    close(fd);
+}
+
+// Measures the disk at usb_path and applies the profile to the keys
+// dumper.cfg leaves unset. Once saved they are set, and later runs skip
+// the probe.
+void usb_probe(char *usb_path, char *cfg_path)
+{
+    int keys = CFG_DECRYPT_WINDOW | CFG_IO_WRITERS;
+    if ((config.usb_probe >= 2) && !config.stripe)
+        keys |= CFG_ARCHIVE | CFG_COMPRESS;
+    keys &= ~config.manual;
+    if ((keys == 0) || config.net_port)
+    {
+        printfsocket("usb probe: nothing to tune\n");
+        return;
+    }
+
+    probe_t p;
+    notify_set("Measuring USB disk...");
+    int res = usb_probe_measure(usb_path, &probe_ps4_io, &p);
+    notify_clear();
+    if (res != 0)
+    {
+        logsocket(LOG_ERROR, "usb probe: cannot write %s\n", usb_path);
+        return;
+    }
+
+    for (int i = 0; i < PROBE_CHUNKS; i++)
+        printfsocket("usb probe: %u KiB writes %u KiB/s\n", p.chunk[i] / 1024, p.chunk_rate[i]);
+    for (int i = 1; i < PROBE_DEPTHS; i++)
+        printfsocket("usb probe: %u writers %u KiB/s\n", p.depth[i], p.depth_rate[i]);
+    printfsocket("usb probe: read back %u KiB/s, %u files/s created\n", p.read_rate, p.file_rate);
+    if (!p.verified)
+    {
+        logsocket(LOG_ERROR, "usb probe: data read back differs\n");
+        notify_post("Warning: USB disk returned corrupted data!");
+    }
+
+    probe_profile_t profile;
+    usb_probe_pick(&p, config.usb_probe, &profile);
+    if (keys & CFG_DECRYPT_WINDOW)
+        config.decrypt_window = profile.decrypt_window;
+    if (keys & CFG_IO_WRITERS)
+        config.io_writers = profile.io_writers;
+    if (keys & CFG_ARCHIVE)
+        config.archive = profile.archive;
+    if (keys & CFG_COMPRESS)
+        config.compress = profile.compress;
+    printfsocket("usb probe: decrypt_window=%d io_writers=%d archive=%d compress=%d\n",
+        config.decrypt_window, config.io_writers, config.archive, config.compress);
+
+    if (config.usb_probe_save)
+        probe_save(cfg_path, &p, keys);
+}
@@ -0,0 +1,100 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "stage.h"
+#include "trace.h"
+#include "hist.h"
+
+// Minimal DAG runner: every enabled stage gets its own thread, waits until
+// all of its dependencies are done, runs, then wakes up its dependents.
+// Disabled stages count as done right away. A stage with stats gets the
+// time it ran recorded there.
+
+#define STAGE_MAX 16
+
+typedef struct {
+    stage_t *stages;
+    int num;
+    ScePthreadMutex mutex;
+    ScePthreadCond cond;
+} StageGraph;
+
+typedef struct {
+    StageGraph *graph;
+    int index;
+} StageThread;
+
+static int deps_done(StageGraph *g, stage_t *st)
+{
+    for (int i = 0; i < st->ndeps; i++)
+    {
+        if (!g->stages[st->deps[i]].done)
+            return 0;
+    }
+    return 1;
+}
+
+static void *stage_thread_func(void *arg)
+{
+    StageThread *t = (StageThread *)arg;
+    StageGraph *g = t->graph;
+    stage_t *st = &g->stages[t->index];
+
+    scePthreadMutexLock(&g->mutex);
+    while (!deps_done(g, st))
+        scePthreadCondWait(&g->cond, &g->mutex);
+    scePthreadMutexUnlock(&g->mutex);
+
+    printfsocket("stage %s start\n", st->name);
+    stats_start(st->stats, st->name);
+    trace_thread(st->name);
+    uint64_t span = trace_begin();
+    st->run(st->arg);
+    trace_end(st->name, span, 0);
+    stats_stop(st->stats);
+    printfsocket("stage %s done\n", st->name);
+    hist_release();
+
+    scePthreadMutexLock(&g->mutex);
+    st->done = 1;
+    scePthreadCondBroadcast(&g->cond);
+    scePthreadMutexUnlock(&g->mutex);
+
+    return NULL;
+}
+
+void stage_run_all(stage_t *stages, int num)
+{
+    StageGraph g;
+    StageThread args[STAGE_MAX];
+    ScePthread threads[STAGE_MAX];
+
+    if (num > STAGE_MAX)
+        num = STAGE_MAX;
+
+    g.stages = stages;
+    g.num = num;
+    scePthreadMutexInit(&g.mutex, NULL, "stage");
+    scePthreadCondInit(&g.cond, NULL, "stage");
+
+    for (int i = 0; i < num; i++)
+        stages[i].done = !stages[i].enabled;
+
+    for (int i = 0; i < num; i++)
+    {
+        if (!stages[i].enabled)
+            continue;
+        args[i].graph = &g;
+        args[i].index = i;
+        scePthreadCreate(&threads[i], NULL, stage_thread_func, &args[i], stages[i].name);
+    }
+
+    for (int i = 0; i < num; i++)
+    {
+        if (stages[i].enabled)
+            scePthreadJoin(threads[i], NULL);
+    }
+
+    scePthreadCondDestroy(&g.cond);
+    scePthreadMutexDestroy(&g.mutex);
+}
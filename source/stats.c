@@ -0,0 +1,64 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "stats.h"
+
+// Microseconds of the monotonic clock, clock_gettime() straight from the
+// kernel with a timespec of seconds and nanoseconds.
+uint64_t stats_now(void)
+{
+    uint64_t ts[2];
+    syscall(232, 4, ts);
+    return ts[0] * 1000000 + ts[1] / 1000;
+}
+
+void stats_start(stats_t *st, const char *name)
+{
+    if (st == NULL)
+        return;
+    memset(st, 0, sizeof(stats_t));
+    st->name = name;
+    st->started = stats_now();
+}
+
+void stats_stop(stats_t *st)
+{
+    if (st != NULL)
+        st->elapsed = stats_now() - st->started;
+}
+
+// The decrypt workers of a phase share its counters.
+void stats_io(stats_t *st, uint32_t calls, uint64_t read, uint64_t written)
+{
+    if (st == NULL)
+        return;
+    __atomic_add_fetch(&st->calls, calls, __ATOMIC_RELAXED);
+    if (read)
+        __atomic_add_fetch(&st->read, read, __ATOMIC_RELAXED);
+    if (written)
+        __atomic_add_fetch(&st->written, written, __ATOMIC_RELAXED);
+}
+
+void stats_file(stats_t *st)
+{
+    if (st != NULL)
+        __atomic_add_fetch(&st->files, 1, __ATOMIC_RELAXED);
+}
+
+// Adds the counters of a phase to a total, the time is the total's own.
+void stats_sum(stats_t *total, stats_t *st)
+{
+    total->read += st->read;
+    total->written += st->written;
+    total->files += st->files;
+    total->calls += st->calls;
+}
+
+// One phase as a JSON object, MB/s are of the bytes written.
+int stats_json(char *buf, stats_t *st)
+{
+    uint64_t us = st->elapsed ? st->elapsed : 1;
+    uint64_t rate = st->written * 100 / us;
+    return sprintf(buf, "{\"name\": \"%s\", \"ms\": %"PRIu64", \"read\": %"PRIu64", \"written\": %"PRIu64", \"files\": %u, \"calls\": %u, \"mbps\": %u.%02u}",
+        st->name, st->elapsed / 1000, st->read, st->written, st->files, st->calls, (uint32_t)(rate / 100), (uint32_t)(rate % 100));
+}
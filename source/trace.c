@@ -0,0 +1,118 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "trace.h"
+
+// Every thread claims its slots with an atomic add, so spans of the stage
+// threads and decrypt workers land in the same buffer without locking.
+// Once it is full further spans are only counted.
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+    uint64_t arg;
+    uint32_t tid;
+} TraceEvent;
+
+// Duration of the thread name records.
+#define TRACE_THREAD_NAME 0xFFFFFFFFFFFFFFFFULL
+
+int trace_enabled;
+static TraceEvent *trace_events;
+static uint32_t trace_count;
+static uint32_t trace_dropped;
+static uint64_t trace_origin;
+
+static uint32_t trace_tid(void)
+{
+    return (uint32_t)((uintptr_t)scePthreadSelf() >> 4);
+}
+
+void trace_open(void)
+{
+    trace_events = malloc(sizeof(TraceEvent) * TRACE_MAX_EVENTS);
+    trace_count = 0;
+    trace_dropped = 0;
+    trace_origin = stats_now();
+    trace_enabled = (trace_events != NULL);
+}
+
+static TraceEvent *trace_slot(void)
+{
+    uint32_t i = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    if (i >= TRACE_MAX_EVENTS)
+    {
+        __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return &trace_events[i];
+}
+
+// Names the calling thread in the trace.
+void trace_thread(const char *name)
+{
+    if (!trace_enabled)
+        return;
+    TraceEvent *e = trace_slot();
+    if (e == NULL)
+        return;
+    e->name = name;
+    e->start = 0;
+    e->dur = TRACE_THREAD_NAME;
+    e->tid = trace_tid();
+    e->arg = 0;
+}
+
+void trace_event(const char *name, uint64_t start, uint64_t arg)
+{
+    uint64_t end = stats_now();
+    TraceEvent *e = trace_slot();
+    if (e == NULL)
+        return;
+    e->name = name;
+    e->start = start - trace_origin;
+    e->dur = end - start;
+    e->tid = trace_tid();
+    e->arg = arg;
+}
+
+// Writes the trace and stops tracing, the threads that fill it are gone
+// by then.
+void trace_close(const char *path)
+{
+    if (!trace_enabled)
+        return;
+    trace_enabled = 0;
+
+    char *buf = malloc(0x10000);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    if ((fd != -1) && (buf != NULL))
+    {
+        uint32_t count = (trace_count < TRACE_MAX_EVENTS) ? trace_count : TRACE_MAX_EVENTS;
+        size_t size = sprintf(buf, "{\"otherData\": {\"version\": \"%s\", \"dropped\": %u},\n\"traceEvents\": [\n", VERSION, trace_dropped);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            TraceEvent *e = &trace_events[i];
+            if (e->dur == TRACE_THREAD_NAME)
+                size += sprintf(buf + size, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                    e->tid, e->name);
+            else
+                size += sprintf(buf + size, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %"PRIu64", \"dur\": %"PRIu64", \"args\": {\"arg\": %"PRIu64"}}",
+                    e->name, e->tid, e->start, e->dur, e->arg);
+            size += sprintf(buf + size, (i + 1 < count) ? ",\n" : "\n");
+            if (size > 0x10000 - 512)
+            {
+                write(fd, buf, size);
+                size = 0;
+            }
+        }
+        size += sprintf(buf + size, "]}\n");
+        write(fd, buf, size);
+    }
+    if (fd != -1)
+        close(fd);
+    free(buf);
+    free(trace_events);
+    trace_events = NULL;
+}
@@ -5,151 +5,510 @@
 #include "ps4.h"
 #include "defines.h"
 #include "debug.h"
+#include "main.h"
+#include "dump.h"
+#include "io.h"
 #include "unpfs.h"
-
-#include "unpfs.h"
-
-int pfs;
-size_t pfs_size, pfs_copied;
-struct pfs_header_t *header;
-struct di_d32 *inodes;
+#include "trace.h"
+#include "hist.h"
+#include "notify.h"
+#include "path.h"
 
 #define BUFFER_SIZE 0x100000
 
-char *copy_buffer;
-
-void memcpy_to_file(const char *fname, uint64_t ptr, uint64_t size)
+void memcpy_to_file(struct unpfs_t *u, const char *fname, int pfs, uint64_t ptr, uint64_t size)
 {
   size_t bytes;
   size_t ix = 0;
-  int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-  if (fd != -1)
+  char *self_name = NULL;
+  uint64_t length = size;
+  uint64_t span = trace_begin();
+  uint64_t started;
+
+  bytes = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
+  started = stats_now();
+  lseek(pfs, ptr, SEEK_SET);
+  read(pfs, u->copy_buffer, bytes);
+  hist_record(HIST_PFS_READ, started);
+  stats_io(u->stats, 2, bytes, 0);
+
+  // Executables are written again by decrypt_dir(), so the encrypted
+  // copy is either skipped or moved aside for archival. Files decrypt_dir()
+  // passes over with skip_assets are copied as they are.
+  if (is_self_header((uint8_t *)u->copy_buffer, bytes) && !(config.skip_assets && is_asset_name(fname)))
+  {
+    if (!config.keep_selfs)
+    {
+      tracesocket(">defer self %s\n", fname);
+      u->copied += size;
+      if (u->copied > u->manifest.size) u->copied = u->manifest.size;
+      return;
+    }
+    self_name = malloc(strlen(fname) + 6);
+    sprintf(self_name, "%s.self", fname);
+    fname = self_name;
+  }
+
+  io_file_t *fd = io_open(fname, size);
+  stats_io(u->stats, 1, 0, 0);
+  if (fd != NULL)
   {
+    stats_file(u->stats);
     while (size > 0)
     {
-      bytes = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
-      lseek(pfs, ptr + ix * BUFFER_SIZE, SEEK_SET);
-      read(pfs, copy_buffer, bytes);
-      write(fd, copy_buffer, bytes);
+      io_write(fd, u->copy_buffer, bytes);
+      stats_io(u->stats, 1, 0, bytes);
       size -= bytes;
       ix++;
-      pfs_copied += bytes;
-      if (pfs_copied > pfs_size) pfs_copied = pfs_size;
-      sprintf(notify_buf, "%u%% completed...", pfs_copied * 100 / pfs_size);
+      u->copied += bytes;
+      if (u->copied > u->manifest.size) u->copied = u->manifest.size;
+      char msg[32];
+      sprintf(msg, "%u%% completed...", (uint32_t)(u->copied * 100 / u->manifest.size));
+      notify_set(msg);
+      if (size > 0)
+      {
+        bytes = (size > BUFFER_SIZE) ? BUFFER_SIZE : size;
+        started = stats_now();
+        lseek(pfs, ptr + ix * BUFFER_SIZE, SEEK_SET);
+        read(pfs, u->copy_buffer, bytes);
+        hist_record(HIST_PFS_READ, started);
+        stats_io(u->stats, 2, bytes, 0);
+      }
     }
-    close(fd);
+    io_close(fd);
+    stats_io(u->stats, 1, 0, 0);
   }
   else
   {
-    sprintf(notify_buf, "Error: cannot copy file %s!", fname);
+    char msg[NOTIFY_SIZE + 32];
+    sprintf(msg, "Error: cannot copy file %.200s!", fname);
+    notify_post(msg);
   }
+
+  free(self_name);
+  trace_end("memcpy_to_file", span, length);
 }
 
-static void parse_directory(int ino, int lev, char *parent_name, bool dry_run)
+// Reads from the image, an image still being installed is read once the
+// disc copy got there. Marks the image failed if the copy stalled.
+static ssize_t pfs_read(struct pfs_t *p, void *buf, size_t size, uint64_t pos)
 {
-  for (uint32_t z = 0; z < inodes[ino].blocks; z++) 
-  {
-    uint32_t db = inodes[ino].db[0] + z;
-    uint64_t pos = (uint64_t)header->blocksz * db;
-    uint64_t size = inodes[ino].size;
-    uint64_t top = pos + size;
-    printfsocket("inode ino=0x%x db=0x%x pos=0x%"PRIx64" size=%"PRIu64"\n", ino, db, pos, size);
-    while (pos < top)
-    {
-      struct dirent_t *ent = malloc (sizeof(struct dirent_t));
-      lseek(pfs, pos, SEEK_SET);
-      read(pfs, ent, sizeof(struct dirent_t));
+  if ((p->bd != NULL) && bdcopy_wait(p->bd, p->base + pos, size))
+  {
+    p->failed = 1;
+    return -1;
+  }
+  lseek(p->fd, pos, SEEK_SET);
+  return read(p->fd, buf, size);
+}
 
-      if (ent->type == 0)
-      {
-        free(ent);
-        break;
-      }
+// FNV-1a, good enough to spread relative paths over the lookup table.
+static uint32_t hash_name(const char *name)
+{
+  uint32_t h = 0x811C9DC5;
+  while (*name)
+  {
+    h ^= (uint8_t)*name++;
+    h *= 0x01000193;
+  }
+  return h;
+}
+
+static void manifest_rehash(struct pfs_manifest_t *m)
+{
+  free(m->table);
+  m->tsize = m->tsize ? m->tsize * 2 : 1024;
+  m->table = malloc(sizeof(uint32_t) * m->tsize);
+  memset(m->table, 0xFF, sizeof(uint32_t) * m->tsize);
+  for (uint32_t i = 0; i < m->count; i++)
+  {
+    uint32_t h = hash_name(m->entries[i].name) & (m->tsize - 1);
+    while (m->table[h] != PFS_NO_ENTRY)
+      h = (h + 1) & (m->tsize - 1);
+    m->table[h] = i;
+  }
+}
+
+// Adds an entry to the manifest. An entry with the same relative path that
+// was added earlier (app image) is overridden in place, so each output file
+// keeps a single slot and gets written exactly once.
+static void manifest_add(struct pfs_manifest_t *m, const char *name, int src, int dir, uint64_t offset, uint64_t size)
+{
+  if ((m->count + 1) * 2 > m->tsize)
+    manifest_rehash(m);
 
-      char *name = malloc(ent->namelen + 1);
-      memset(name, 0, ent->namelen + 1);
-      if (lev > 0)
+  uint32_t h = hash_name(name) & (m->tsize - 1);
+  while (m->table[h] != PFS_NO_ENTRY)
+  {
+    struct pfs_entry_t *e = &m->entries[m->table[h]];
+    if (!strcmp(e->name, name))
+    {
+      if (!dir)
       {
-        lseek(pfs, pos + sizeof(struct dirent_t), SEEK_SET);
-        read(pfs, name, ent->namelen);
+        if (!e->dir) m->size -= e->size;
+        m->size += size;
+        e->src = src;
+        e->dir = 0;
+        e->offset = offset;
+        e->size = size;
+        tracesocket(">override %s src=%d\n", name, src);
       }
-      printfsocket(">dent ino=0x%x pos=0x%"PRIx64" name=%s\n", ent->ino, pos, name);
+      return;
+    }
+    h = (h + 1) & (m->tsize - 1);
+  }
 
-      char *fname = malloc(strlen (parent_name) + ent->namelen + 2);
-      if (parent_name != NULL)
-        sprintf(fname, "%s/%s", parent_name, name);
-      else
-        sprintf(fname, "%s", name);
+  if (m->count == m->capacity)
+  {
+    m->capacity = m->capacity ? m->capacity * 2 : 1024;
+    m->entries = realloc(m->entries, sizeof(struct pfs_entry_t) * m->capacity);
+  }
+
+  struct pfs_entry_t *e = &m->entries[m->count];
+  e->name = arena_strdup(&m->names, name);
+  e->src = src;
+  e->dir = dir;
+  e->offset = offset;
+  e->size = size;
+  if (!dir) m->size += size;
+  m->table[h] = m->count++;
+}
+
+static void manifest_free(struct pfs_manifest_t *m)
+{
+  arena_free(&m->names);
+  free(m->entries);
+  free(m->table);
+  memset(m, 0, sizeof(struct pfs_manifest_t));
+}
+
+// Directory blocks are read whole into the scratch arena and released when
+// the level is done, names are appended to path in place, so walking the
+// tree doesn't allocate. The slack lets the last entry run past the size
+// like it does in the image.
+#define PFS_DIRENT_SLACK (sizeof(struct dirent_t) + 0x100)
+
+static void parse_directory(struct pfs_manifest_t *m, struct pfs_t *p, arena_t *scratch, int src, int ino, int lev, path_t *path)
+{
+  uint64_t span = trace_begin();
+  arena_mark_t mark = arena_mark(scratch);
+  for (uint32_t z = 0; z < p->inodes[ino].blocks; z++) 
+  {
+    uint32_t db = p->inodes[ino].db[0] + z;
+    uint64_t pos = (uint64_t)p->header.blocksz * db;
+    uint64_t size = p->inodes[ino].size;
+    size_t bytes = size + PFS_DIRENT_SLACK;
+    tracesocket("inode ino=0x%x db=0x%x pos=0x%"PRIx64" size=%"PRIu64"\n", ino, db, pos, size);
+
+    uint8_t *block = arena_alloc(scratch, bytes);
+    if (block == NULL)
+      break;
+    ssize_t got = pfs_read(p, block, bytes, pos);
+    stats_io(p->stats, 2, bytes, 0);
+    if (p->failed)
+      break;
+    if (got < 0) got = 0;
+    memset(block + got, 0, bytes - got);
+
+    uint64_t off = 0;
+    while (off < size)
+    {
+      struct dirent_t *ent = (struct dirent_t *)(block + off);
+      if ((ent->type == 0) || (off + sizeof(struct dirent_t) + ent->namelen > bytes))
+        break;
+
+      // Names are relative to the image root, the superroot maps to "".
+      size_t parent = path_pushn(path, (char *)(ent + 1), (lev > 0) ? ent->namelen : 0);
+      tracesocket(">dent ino=0x%x pos=0x%"PRIx64" name=%s\n", ent->ino, pos + off, path->buf);
 
       if ((ent->type == 2) && (lev > 0))
       {
-        printfsocket(">file pos=0x%"PRIx64" size=%"PRId64" dest=%s\n",
-               (uint64_t)header->blocksz * inodes[ent->ino].db[0],
-               inodes[ent->ino].size, fname);
-        if (dry_run)
-          pfs_size += inodes[ent->ino].size;
-        else
-          memcpy_to_file(fname, (uint64_t)header->blocksz * inodes[ent->ino].db[0], inodes[ent->ino].size);
+        tracesocket(">file pos=0x%"PRIx64" size=%"PRId64" dest=%s\n",
+               (uint64_t)p->header.blocksz * p->inodes[ent->ino].db[0],
+               p->inodes[ent->ino].size, path->buf);
+        manifest_add(m, path->buf, src, 0, (uint64_t)p->header.blocksz * p->inodes[ent->ino].db[0], p->inodes[ent->ino].size);
       }
       else
       if (ent->type == 3)
       {
-        printfsocket(">scan dir %s\n", name);
-        mkdir(fname, 0777);
-        parse_directory(ent->ino, lev + 1, fname, dry_run);
+        tracesocket(">scan dir %s\n", path->buf);
+        if (path->buf[0] != '\0')
+          manifest_add(m, path->buf, src, 1, 0, 0);
+        parse_directory(m, p, scratch, src, ent->ino, lev + 1, path);
       }
 
-      pos += ent->entsize;
-
-      free(ent);
-      free(name);
-      free(fname);
+      path_pop(path, parent);
+      if (ent->entsize == 0)
+        break;
+      off += ent->entsize;
     }
+    arena_release(scratch, mark);
   }
+  trace_end("parse_directory", span, ino);
 }
 
-int unpfs(char *pfsfn, char *tidpath)
+// Builds the merged manifest of the images, later images override earlier
+// ones. Returns -1 if an image couldn't be read.
+static int manifest_build(struct pfs_manifest_t *m, struct pfs_t *images, int num)
 {
-  copy_buffer = malloc(BUFFER_SIZE);
+  arena_t scratch;
+  path_t path;
+
+  arena_init(&scratch);
+  path_init(&path, "");
+  for (int i = 0; i < num; i++)
+    parse_directory(m, &images[i], &scratch, i, images[i].header.superroot_ino, 0, &path);
+  path_free(&path);
+  arena_free(&scratch);
 
-  mkdir(tidpath, 0777);
+  for (int i = 0; i < num; i++)
+    if (images[i].failed)
+      return -1;
+  return 0;
+}
+
+static void pfs_close(struct pfs_t *p)
+{
+  free(p->inodes);
+  p->inodes = NULL;
+  if (p->fd >= 0)
+  {
+    close(p->fd);
+    stats_io(p->stats, 1, 0, 0);
+  }
+}
 
-  pfs = open(pfsfn, O_RDONLY, 0);
-  if (pfs < 0) return -1;
+// bd is the disc install the image is still coming from, or NULL.
+static int pfs_open(struct pfs_t *p, char *pfsfn, bdcopy_t *bd, stats_t *st)
+{
+  p->inodes = NULL;
+  p->stats = st;
+  p->bd = bd;
+  p->base = 0;
+  p->failed = 0;
+  p->fd = open(pfsfn, O_RDONLY, 0);
+  stats_io(st, 1, 0, 0);
+  if (p->fd < 0) return -1;
 
-  header = malloc(sizeof(struct pfs_header_t));
-  lseek(pfs, 0, SEEK_SET);
-  read(pfs, header, sizeof(struct pfs_header_t));
+  if ((bd != NULL) && bdcopy_image(bd, &p->base))
+    p->failed = 1;
+  else
+    pfs_read(p, &p->header, sizeof(struct pfs_header_t), 0);
+  stats_io(st, 2, sizeof(struct pfs_header_t), 0);
+  if (p->failed)
+  {
+    pfs_close(p);
+    return -1;
+  }
 
-  inodes = malloc(sizeof(struct di_d32) * header->ndinode);
+  p->inodes = malloc(sizeof(struct di_d32) * p->header.ndinode);
 
   uint32_t ix = 0;
 
-  for (uint32_t i = 0; i < header->ndinodeblock; i++)
+  for (uint32_t i = 0; i < p->header.ndinodeblock; i++)
   {		
-    for (uint32_t j = 0; (j < (header->blocksz / sizeof(struct di_d32))) && (ix < header->ndinode); j++)
+    for (uint32_t j = 0; (j < (p->header.blocksz / sizeof(struct di_d32))) && (ix < p->header.ndinode); j++)
     {
-      lseek(pfs, (uint64_t)header->blocksz * (i + 1) + sizeof(struct di_d32) * j, SEEK_SET);
-      read(pfs, &inodes[ix], sizeof(struct di_d32));
-      printfsocket("inode ino=0x%x pos=0x%"PRIx64" blocks=%d mode=0x%x size=%"PRIu64" uid=0x%x gid=0x%x\n",
-             ix, (uint64_t)header->blocksz * (i + 1) + sizeof(struct di_d32) * j,
-             inodes[ix].blocks, inodes[ix].mode, inodes[ix].size, inodes[ix].uid, inodes[ix].gid);
+      pfs_read(p, &p->inodes[ix], sizeof(struct di_d32), (uint64_t)p->header.blocksz * (i + 1) + sizeof(struct di_d32) * j);
+      stats_io(st, 2, sizeof(struct di_d32), 0);
+      if (p->failed)
+      {
+        pfs_close(p);
+        return -1;
+      }
+      tracesocket("inode ino=0x%x pos=0x%"PRIx64" blocks=%d mode=0x%x size=%"PRIu64" uid=0x%x gid=0x%x\n",
+             ix, (uint64_t)p->header.blocksz * (i + 1) + sizeof(struct di_d32) * j,
+             p->inodes[ix].blocks, p->inodes[ix].mode, p->inodes[ix].size, p->inodes[ix].uid, p->inodes[ix].gid);
       ix++;       
     }
   }
 
-  pfs_size = 0;
-  pfs_copied = 0;
+  return 0;
+}
+
+
+int unpfs_merge(char *appfn, char *patchfn, char *tidpath, bdcopy_t *bd, stats_t *st)
+{
+  struct pfs_t images[2];
+  char *fnames[2] = { appfn, patchfn };
+  int num = (patchfn != NULL) ? 2 : 1;
+
+  io_mkdir(tidpath);
+
+  for (int i = 0; i < num; i++)
+  {
+    if (pfs_open(&images[i], fnames[i], (i == 0) ? bd : NULL, st) < 0)
+    {
+      for (int j = 0; j < i; j++)
+        pfs_close(&images[j]);
+      return -1;
+    }
+  }
+
+  struct unpfs_t u;
+  memset(&u, 0, sizeof(struct unpfs_t));
+  u.stats = st;
+
+  // Index every image first.
+  if (manifest_build(&u.manifest, images, num))
+  {
+    manifest_free(&u.manifest);
+    for (int i = 0; i < num; i++)
+      pfs_close(&images[i]);
+    return -1;
+  }
+
+  printfsocket("manifest: %u entries, %"PRIu64" bytes\n", u.manifest.count, u.manifest.size);
+
+  u.copy_buffer = malloc(BUFFER_SIZE);
+
+  // While the disc install is still running, files of the app image that
+  // aren't fully copied yet are left for later passes.
+  uint32_t *pending = NULL;
+  uint32_t npending = 0;
+  uint64_t base = images[0].base;
+  if (bd != NULL)
+    pending = malloc(sizeof(uint32_t) * u.manifest.count);
+
+  path_t out;
+  path_init(&out, tidpath);
+  for (uint32_t i = 0; i < u.manifest.count; i++)
+  {
+    struct pfs_entry_t *e = &u.manifest.entries[i];
+    size_t mark = path_push(&out, e->name);
+    if (e->dir)
+    {
+      stats_io(st, io_mkdir(out.buf), 0, 0);
+    }
+    else
+    if ((pending != NULL) && (e->src == 0) && !bdcopy_ready(bd, base + e->offset, e->size))
+      pending[npending++] = i;
+    else
+      memcpy_to_file(&u, out.buf, images[e->src].fd, e->offset, e->size);
+    path_pop(&out, mark);
+  }
 
-  parse_directory(header->superroot_ino, 0, tidpath, 1);
-  parse_directory(header->superroot_ino, 0, tidpath, 0);
+  // Files still missing when the copy stalls are left out and the dump
+  // fails.
+  int res = 0;
+  while (npending > 0)
+  {
+    printfsocket("unpfs: %u files waiting for the disc copy\n", npending);
+    if (bdcopy_stalled(bd))
+    {
+      notify_post("Error: the disc copy stopped!");
+      res = -1;
+      break;
+    }
+    char msg[80];
+    sprintf(msg, "Waiting for game to copy\n%u%% completed, %u:%02u left...",
+      (uint32_t)(bd->copied * 100 / bd->blocks), bd->eta / 60, bd->eta % 60);
+    notify_set(msg);
+    sceKernelSleep(1);
+    bdcopy_poll(bd);
+    uint32_t left = 0;
+    for (uint32_t j = 0; j < npending; j++)
+    {
+      struct pfs_entry_t *e = &u.manifest.entries[pending[j]];
+      if (!bdcopy_ready(bd, base + e->offset, e->size))
+      {
+        pending[left++] = pending[j];
+        continue;
+      }
+      size_t mark = path_push(&out, e->name);
+      memcpy_to_file(&u, out.buf, images[e->src].fd, e->offset, e->size);
+      path_pop(&out, mark);
+    }
+    npending = left;
+  }
+  free(pending);
+  path_free(&out);
 
-  notify_buf[0] = '\0';
+  notify_clear();
 
-  free(header);
-  free(inodes);
-  close(pfs);
-  free(copy_buffer);
+  manifest_free(&u.manifest);
+  for (int i = 0; i < num; i++)
+    pfs_close(&images[i]);
+  free(u.copy_buffer);
 	
-  return 0;
+  return res;
+}
+
+int unpfs(char *pfsfn, char *tidpath, stats_t *st)
+{
+  return unpfs_merge(pfsfn, NULL, tidpath, NULL, st);
+}
+
+static int estimate_ready(bdcopy_t *bd, struct pfs_t *images, struct pfs_entry_t *e, size_t bytes)
+{
+  return (bd == NULL) || (e->src != 0) || bdcopy_ready(bd, images[0].base + e->offset, bytes);
+}
+
+// Bytes unpfs_merge() and the SELF stages are going to write for these
+// images: every file of the merged tree, executables at the size of the ELF
+// they decrypt to. App files the disc copy hasn't reached yet can't be
+// probed and count at their size in the image.
+uint64_t unpfs_estimate(char *appfn, char *patchfn, bdcopy_t *bd, uint32_t *files)
+{
+  struct pfs_t images[2];
+  char *fnames[2] = { appfn, patchfn };
+  int num = (patchfn != NULL) ? 2 : 1;
+  struct pfs_manifest_t m;
+  uint64_t total = 0;
+
+  for (int i = 0; i < num; i++)
+  {
+    if (pfs_open(&images[i], fnames[i], (i == 0) ? bd : NULL, NULL) < 0)
+    {
+      for (int j = 0; j < i; j++)
+        pfs_close(&images[j]);
+      return 0;
+    }
+  }
+
+  memset(&m, 0, sizeof(struct pfs_manifest_t));
+  manifest_build(&m, images, num);
+
+  uint8_t *probe = malloc(SELF_HEADER_MAX);
+
+  for (uint32_t i = 0; i < m.count; i++)
+  {
+    struct pfs_entry_t *e = &m.entries[i];
+    if (e->dir)
+      continue;
+    (*files)++;
+
+    // A small probe tells the SELFs, only those get their headers read.
+    uint64_t size = e->size;
+    size_t bytes = (size > SELF_PROBE_SIZE) ? SELF_PROBE_SIZE : size;
+    int fd = images[e->src].fd;
+    if (estimate_ready(bd, images, e, bytes))
+    {
+      lseek(fd, e->offset, SEEK_SET);
+      ssize_t got = read(fd, probe, bytes);
+      if ((got == (ssize_t)bytes) && (bytes >= sizeof(struct self_header_t)) && (((struct self_header_t *)probe)->magic == SELF_MAGIC))
+      {
+        size_t all = (size > SELF_HEADER_MAX) ? SELF_HEADER_MAX : size;
+        if ((all > bytes) && estimate_ready(bd, images, e, all))
+        {
+          ssize_t more = read(fd, probe + bytes, all - bytes);
+          if (more > 0)
+            got += more;
+        }
+        uint64_t elfsz = self_output_size(probe, got, size);
+        if (elfsz > 0)
+          size = config.keep_selfs ? size + elfsz : elfsz;
+      }
+    }
+    total += size;
+  }
+
+  printfsocket("estimate %s: %u files, %"PRIu64" bytes\n", appfn, *files, total);
+
+  free(probe);
+  manifest_free(&m);
+  for (int i = 0; i < num; i++)
+    pfs_close(&images[i]);
+
+  return total;
 }
@@ -6,8 +6,11 @@
 #include "defines.h"
 #include "debug.h"
 #include "unpkg.h"
-
-#define EOF '\00'
+#include "io.h"
+#include "trace.h"
+#include "hist.h"
+#include "arena.h"
+#include "path.h"
 
 // Helper functions.
 static inline uint16_t bswap_16(uint16_t val)
@@ -24,42 +27,27 @@ static inline uint32_t bswap_32(uint32_t val)
     | ((val & (uint32_t)0xff000000UL) >> 24);
 }
 
-static inline int fgetc(int fd)
+// Reads from the package, a package still being installed is read once
+// the disc copy got there.
+static ssize_t pkg_read(int fd, bdcopy_t *bd, void *buf, size_t size, uint64_t pos)
 {
-  char c;
-
-  if (read(fd, &c, 1) < 1)
-    return (EOF);
-  return (c);
+  if ((bd != NULL) && bdcopy_wait(bd, pos, size))
+    return -1;
+  lseek(fd, pos, SEEK_SET);
+  return read(fd, buf, size);
 }
 
-char *read_string(int fd)
+// Creates the parents of path, cutting it short in place for each one.
+static void _mkdir(char *path)
 {
-  char *string = malloc(sizeof(char) * 256);
-  int c;
-  int length = 0;
-  if (!string) return string;
-  while((c = fgetc(fd)) != EOF)
-  {
-    string[length++] = c;
-  }
-  string[length++] = '\0';
-
-  return realloc(string, sizeof(char) * length);
-}
-
-static void _mkdir(const char *dir)
-{
-  char tmp[256];
   char *p = NULL;
 
-  snprintf(tmp, sizeof(tmp), "%s", dir);
-  for (p = tmp + 1; *p; p++)
+  for (p = path + 1; *p; p++)
   {
     if (*p == '/')
     {
       *p = 0;
-      mkdir(tmp, 0777);
+      io_mkdir(path);
       *p = '/';
     }
   }
@@ -71,9 +59,10 @@ static void _mkdir(const char *dir)
     break;\
 }
 
-char *get_entry_name_by_type(uint32_t type)
+// Numbered names are formatted into buf, 32 bytes.
+char *get_entry_name_by_type(uint32_t type, char *buf)
 {
-  char *entry_name = malloc(32);
+  char *entry_name = buf;
 
   if ((type >= 0x1201) && (type <= 0x121F))
     sprintf(entry_name, "icon0_%02u.png", type - 0x1201);
@@ -100,7 +89,6 @@ char *get_entry_name_by_type(uint32_t type)
     sprintf(entry_name, "keymap_rp/%02u/%03u.png", (type - 0x1610) / 0x10, (type - 0x1610) % 0x10);
   else
   {
-    free(entry_name);
     entry_name = NULL;
     switch (type) {
       caseentry(0x0400, "license.dat");
@@ -140,14 +128,17 @@ char *get_entry_name_by_type(uint32_t type)
   return entry_name;
 }
 
-int unpkg(char *pkgfn, char *tidpath)
+int unpkg(char *pkgfn, char *tidpath, bdcopy_t *bd, stats_t *st)
 {
   struct cnt_pkg_main_header m_header;
   struct cnt_pkg_content_header c_header;
+  arena_t arena;
   memset(&m_header, 0, sizeof(struct cnt_pkg_main_header));
   memset(&c_header, 0, sizeof(struct cnt_pkg_content_header));
+  arena_init(&arena);
 
   int fdin = open(pkgfn, O_RDONLY, 0);
+  stats_io(st, 1, 0, 0);
   if (fdin == -1)
   {
     printfsocket("File not found!\n");
@@ -155,12 +146,18 @@ int unpkg(char *pkgfn, char *tidpath)
   }
 
   // Read in the main CNT header (size seems to be 0x180 with 4 hashes included).
-  lseek(fdin, 0, SEEK_SET);
-  read(fdin, &m_header, 0x180);
+  if (pkg_read(fdin, bd, &m_header, 0x180, 0) < 0)
+  {
+    printfsocket("Disc copy stalled!\n");
+    close(fdin);
+    return 4;
+  }
+  stats_io(st, 2, 0x180, 0);
 
   if (m_header.magic != PS4_PKG_MAGIC)
   {
     printfsocket("Invalid PS4 PKG file!\n");
+    close(fdin);
     return 2;
   }
 
@@ -173,8 +170,8 @@ int unpkg(char *pkgfn, char *tidpath)
   printfsocket("\n");
 
   // Seek to offset 0x400 and read content associated header (size seems to be 0x80 with 2 hashes included).
-  lseek(fdin, 0x400, SEEK_SET);
-  read(fdin, &c_header, 0x80);
+  pkg_read(fdin, bd, &c_header, 0x80, 0x400);
+  stats_io(st, 2, 0x80, 0);
 
   printfsocket("PS4 PKG content header:\n");
   printfsocket("- PKG content offset: 0x%X\n", bswap_32(c_header.content_offset));
@@ -182,7 +179,15 @@ int unpkg(char *pkgfn, char *tidpath)
   printfsocket("\n");
 
   // Locate the entry table and list each type of section inside the PKG/CNT file.
-  lseek(fdin, bswap_32(m_header.file_table_offset), SEEK_SET);
+  uint32_t table = bswap_32(m_header.file_table_offset);
+  if ((bd != NULL) && bdcopy_wait(bd, table, 0x20 * bswap_16(m_header.table_entries_num)))
+  {
+    printfsocket("Disc copy stalled!\n");
+    close(fdin);
+    return 4;
+  }
+  lseek(fdin, table, SEEK_SET);
+  stats_io(st, 1 + bswap_16(m_header.table_entries_num), 0x20 * bswap_16(m_header.table_entries_num), 0);
 
   printfsocket("PS4 PKG table entries:\n");
   struct cnt_pkg_table_entry *entries = malloc(sizeof(struct cnt_pkg_table_entry) * bswap_16(m_header.table_entries_num));
@@ -191,23 +196,20 @@ int unpkg(char *pkgfn, char *tidpath)
   for (i = 0; i < bswap_16(m_header.table_entries_num); i++)
   {
     read(fdin, &entries[i], 0x20);
-    printfsocket("Entry #%d\n", i);
-    printfsocket("- PKG table entry type: 0x%X\n", bswap_32(entries[i].type));
-    printfsocket("- PKG table entry offset: 0x%X\n", bswap_32(entries[i].offset));
-    printfsocket("- PKG table entry size: 0x%X\n", bswap_32(entries[i].size));
-    printfsocket("\n");
+    tracesocket("Entry #%d\n", i);
+    tracesocket("- PKG table entry type: 0x%X\n", bswap_32(entries[i].type));
+    tracesocket("- PKG table entry offset: 0x%X\n", bswap_32(entries[i].offset));
+    tracesocket("- PKG table entry size: 0x%X\n", bswap_32(entries[i].size));
+    tracesocket("\n");
   }
 
   // Vars for file name listing.
   struct file_entry *entry_files = malloc(sizeof(struct file_entry) * bswap_16(m_header.table_entries_num));
   memset(entry_files, 0, sizeof(struct file_entry) * bswap_16(m_header.table_entries_num));
-  char *file_name_list[256];
+  char **file_name_list = NULL;
   int file_name_index = 0;
   int file_count = 0;
 
-  // Var for file writing.
-  unsigned char *entry_file_data;
-
   // Search through the data entries and locate the name table entry.
   // This section should keep relevant strings for internal files inside the PKG/CNT file.
   for (i = 0; i < bswap_16(m_header.table_entries_num); i++)
@@ -215,11 +217,25 @@ int unpkg(char *pkgfn, char *tidpath)
     if (bswap_32(entries[i].type) == PS4_PKG_ENTRY_TYPE_NAME_TABLE)
     {
       printfsocket("Found name table entry. Extracting file names:\n");
-      lseek(fdin, bswap_32(entries[i].offset) + 1, SEEK_SET);
-      while ((file_name_list[file_name_index] = read_string(fdin))[0] != '\0')
+      // The table is read whole, names follow a leading NUL and end at
+      // the first empty one.
+      uint32_t size = bswap_32(entries[i].size);
+      char *names = arena_alloc(&arena, size + 1);
+      ssize_t got = pkg_read(fdin, bd, names, size, bswap_32(entries[i].offset));
+      stats_io(st, 2, size, 0);
+      names[(got > 0) ? got : 0] = '\0';
+
+      int count = 0;
+      for (char *s = names + 1; (s < names + got) && (*s != '\0'); s += strlen(s) + 1)
+        count++;
+      char **list = arena_alloc(&arena, sizeof(char *) * (file_name_index + count));
+      if (file_name_index > 0)
+        memcpy(list, file_name_list, sizeof(char *) * file_name_index);
+      file_name_list = list;
+      for (char *s = names + 1; (s < names + got) && (*s != '\0'); s += strlen(s) + 1)
       {
-        printfsocket("%s\n", file_name_list[file_name_index]);
-        file_name_index++;
+        tracesocket("%s\n", s);
+        file_name_list[file_name_index++] = s;
       }
       printfsocket("\n");
     }
@@ -230,7 +246,7 @@ int unpkg(char *pkgfn, char *tidpath)
   for (i = 0; i < bswap_16(m_header.table_entries_num); i++)
   {
     // Use a predefined list for most file names.
-    entry_files[i].name = get_entry_name_by_type(bswap_32(entries[i].type));
+    entry_files[i].name = get_entry_name_by_type(bswap_32(entries[i].type), arena_alloc(&arena, 32));
     entry_files[i].offset = bswap_32(entries[i].offset);
     entry_files[i].size = bswap_32(entries[i].size);
 
@@ -239,7 +255,7 @@ int unpkg(char *pkgfn, char *tidpath)
     {
       // If a file was found and it's name is not on the predefined list, try to map it with
       // a name from the name table.
-      if (entry_files[i].name == NULL)
+      if ((entry_files[i].name == NULL) && (file_count < file_name_index))
       {
         entry_files[i].name = file_name_list[file_count];
       }
@@ -252,49 +268,120 @@ int unpkg(char *pkgfn, char *tidpath)
   printfsocket("Successfully mapped %d files.\n\n", file_count);
 
   // Set up the output directory for file writing.
-  char dest_path[256];
-  char title_id[256];
+  path_t dest_path;
+  unsigned char *entry_file_data = NULL;
+  size_t entry_file_size = 0;
 
-  memset(title_id, 0, 256);
-  memcpy(title_id, tidpath, 255);
-  mkdir(title_id, 0777);
+  io_mkdir(tidpath);
+  path_init(&dest_path, tidpath);
+  path_push(&dest_path, "sce_sys");
+  size_t sce_sys = dest_path.len;
 
   // Search through the entries for mapped file data and output it.
   printfsocket("Dumping internal PKG files...\n");
   for (i = 0; i < bswap_16(m_header.table_entries_num); i++)
   {
-    entry_file_data = (unsigned char *)realloc(NULL, entry_files[i].size);
+    if ((size_t)entry_files[i].size > entry_file_size)
+    {
+      entry_file_size = entry_files[i].size;
+      entry_file_data = (unsigned char *)realloc(entry_file_data, entry_file_size);
+    }
 
-    lseek(fdin, entry_files[i].offset, SEEK_SET);
-    read(fdin, entry_file_data, entry_files[i].size);
+    uint64_t started = stats_now();
+    ssize_t got = pkg_read(fdin, bd, entry_file_data, entry_files[i].size, entry_files[i].offset);
+    hist_record(HIST_PKG_READ, started);
+    stats_io(st, 2, entry_files[i].size, 0);
+    if ((got < 0) && (bd != NULL) && bd->failed)
+    {
+      printfsocket("Disc copy stalled!\n");
+      close(fdin);
+      free(entries);
+      free(entry_files);
+      free(entry_file_data);
+      path_free(&dest_path);
+      arena_free(&arena);
+      return 4;
+    }
 
     if (entry_files[i].name == NULL) continue;
 
-    sprintf(dest_path, "%s/sce_sys/%s", title_id, entry_files[i].name);
-    printfsocket("%s\n", dest_path);
+    path_pop(&dest_path, sce_sys);
+    path_push(&dest_path, entry_files[i].name);
+    tracesocket("%s\n", dest_path.buf);
 
-    _mkdir (dest_path);
+    _mkdir (dest_path.buf);
 
-    int fdout = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-    if (fdout != -1)
+    uint64_t span = trace_begin();
+    io_file_t *fdout = io_open(dest_path.buf, entry_files[i].size);
+    if (fdout != NULL)
     {
-      write(fdout, entry_file_data, entry_files[i].size);
-      close(fdout);
+      io_write(fdout, entry_file_data, entry_files[i].size);
+      io_close(fdout);
+      stats_io(st, 3, 0, entry_files[i].size);
+      stats_file(st);
+      trace_end("unpkg_entry", span, entry_files[i].size);
     }
     else
     {
       printfsocket("Can't open file for writing!\n");
+      close(fdin);
+      free(entries);
+      free(entry_files);
+      free(entry_file_data);
+      path_free(&dest_path);
+      arena_free(&arena);
       return 3;
     }
   }
 
   // Clean up.
   close(fdin);
+  stats_io(st, 1, 0, 0);
 
   free(entries);
   free(entry_files);
+  free(entry_file_data);
+  path_free(&dest_path);
+  arena_free(&arena);
 
   printfsocket("Done.\n");
 
   return 0;
 }
+
+// Bytes unpkg() is going to write, from the entry table alone. Named files
+// are counted even if the name table runs short of names for them.
+uint64_t unpkg_estimate(char *pkgfn, bdcopy_t *bd, uint32_t *files)
+{
+  struct cnt_pkg_main_header m_header;
+  struct cnt_pkg_table_entry entry;
+  char name[32];
+  uint64_t total = 0;
+
+  int fdin = open(pkgfn, O_RDONLY, 0);
+  if (fdin == -1)
+    return 0;
+
+  memset(&m_header, 0, sizeof(struct cnt_pkg_main_header));
+  pkg_read(fdin, bd, &m_header, 0x180, 0);
+  if (m_header.magic == PS4_PKG_MAGIC)
+  {
+    uint32_t table = bswap_32(m_header.file_table_offset);
+    for (int i = 0; i < bswap_16(m_header.table_entries_num); i++)
+    {
+      if (pkg_read(fdin, bd, &entry, 0x20, table + i * 0x20) != 0x20)
+        break;
+      uint32_t type = bswap_32(entry.type);
+      if ((get_entry_name_by_type(type, name) != NULL)
+      || ((type & PS4_PKG_ENTRY_TYPE_FILE1) == PS4_PKG_ENTRY_TYPE_FILE1)
+      || ((type & PS4_PKG_ENTRY_TYPE_FILE2) == PS4_PKG_ENTRY_TYPE_FILE2))
+      {
+        total += bswap_32(entry.size);
+        (*files)++;
+      }
+    }
+  }
+  close(fdin);
+
+  return total;
+}
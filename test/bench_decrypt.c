@@ -0,0 +1,131 @@
+#include "ps4.h"
+#include "main.h"
+#include "dump.h"
+#include "io.h"
+#include "test.h"
+
+// Decryption of a SELF with many large segments, as decrypt_self() does it
+// now against how the dumper did it before the prefetch pipeline: every
+// segment mapped 1 MiB at a time into a buffer of its own, then written
+// out, so decryption and the USB disk take turns. Run with decryption and
+// the disk simulated at their speeds on the console, and without delays for
+// the CPU cost alone.
+
+#define PT_LOAD  1
+#define SEGS     6
+#define SEG_SIZE 0x600000
+#define OLD_WINDOW 0x100000
+
+static int old_dump(const char *selffn, const char *out)
+{
+    int fd = open(selffn, O_RDONLY, 0);
+    uint8_t *header = malloc(SELF_HEADER_MAX);
+    ssize_t got = pread(fd, header, SELF_HEADER_MAX, 0);
+    struct self_header_t *hdr = (struct self_header_t *)header;
+    struct self_entry_t *entries = (struct self_entry_t *)(header + sizeof(struct self_header_t));
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)(entries + hdr->num_entries);
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)(ehdr + 1);
+    int num = 0;
+    SegmentBufInfo *infos = parse_phdr(phdrs, ehdr->e_phnum, entries, hdr->num_entries, got, &num);
+
+    int sf = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    write(sf, ehdr, sizeof(Elf64_Ehdr) + ehdr->e_phnum * sizeof(Elf64_Phdr));
+    for (int i = 0; i < num; i++)
+    {
+        uint8_t *buf = calloc(1, infos[i].bufsz);
+        for (size_t off = 0; off < infos[i].filesz; off += OLD_WINDOW)
+        {
+            size_t bytes = (infos[i].filesz - off > OLD_WINDOW) ? OLD_WINDOW : infos[i].filesz - off;
+            uint8_t *addr = mmap(0, bytes, PROT_READ, MAP_PRIVATE | 0x80000, fd, ((uint64_t)infos[i].index << 32) | off);
+            memcpy(buf + off, addr, bytes);
+            munmap(addr, bytes);
+        }
+        lseek(sf, infos[i].fileoff, SEEK_SET);
+        write(sf, buf, infos[i].bufsz);
+        free(buf);
+    }
+    close(sf);
+    close(fd);
+    free(infos);
+    free(header);
+    return 0;
+}
+
+static uint64_t run_old(const char *selffn, const char *out)
+{
+    uint64_t start = stats_now();
+    old_dump(selffn, out);
+    return stats_now() - start;
+}
+
+static uint64_t run_new(const char *selffn, const char *out, int queue)
+{
+    config.decrypt_queue = queue;
+    uint64_t start = stats_now();
+    CHECK(decrypt_and_dump_self((char *)selffn, (char *)out) == 0);
+    return stats_now() - start;
+}
+
+static void report(const char *name, uint64_t us)
+{
+    uint64_t bytes = (uint64_t)SEGS * SEG_SIZE;
+    printf("  %-28s %6llu ms  %4llu MiB/s\n", name, (unsigned long long)(us / 1000),
+           (unsigned long long)((bytes * 1000000 / (us ? us : 1)) >> 20));
+}
+
+static void same_output(const char *dir, const char *out)
+{
+    char old[256];
+    size_t size;
+    snprintf(old, sizeof(old), "%s/old.elf", dir);
+    void *data = test_read_file(old, &size);
+    CHECK((data != NULL) && test_file_equals(out, data, size));
+    free(data);
+}
+
+static void bench(const char *dir, const char *selffn, int decrypt_mbs, int usb_mbs)
+{
+    char out[256], name[64];
+    host_decrypt_usec = decrypt_mbs ? 1000000 / decrypt_mbs : 0;
+    host_write_usec = usb_mbs ? 1000000 / usb_mbs : 0;
+    if (decrypt_mbs)
+        printf("decryption %d MiB/s, USB disk %d MiB/s:\n", decrypt_mbs, usb_mbs);
+    else
+        printf("no simulated delays:\n");
+
+    snprintf(out, sizeof(out), "%s/old.elf", dir);
+    report("before: segment at a time", run_old(selffn, out));
+    for (int queue = 2; queue <= 8; queue *= 2)
+    {
+        snprintf(out, sizeof(out), "%s/new-%d.elf", dir, queue);
+        snprintf(name, sizeof(name), "after: decrypt_queue=%d", queue);
+        report(name, run_new(selffn, out, queue));
+        same_output(dir, out);
+    }
+    host_decrypt_usec = host_write_usec = 0;
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char selffn[256];
+    test_self_segment_t segs[SEGS];
+
+    memset(segs, 0, sizeof(segs));
+    for (int i = 0; i < SEGS; i++)
+    {
+        segs[i].phdr = (Elf64_Phdr){ PT_LOAD, 5, 0x4000 + (uint64_t)i * SEG_SIZE, 0, 0, SEG_SIZE, SEG_SIZE, 0x4000 };
+        segs[i].props = SELF_ENTRY_ENCRYPTED;
+    }
+    snprintf(selffn, sizeof(selffn), "%s/eboot.bin", dir);
+    CHECK(test_self_build(selffn, segs, SEGS) > 0);
+
+    config.decrypt_window = 1024;
+    printf("bench_decrypt: %d segments of %d MiB\n", SEGS, SEG_SIZE >> 20);
+    bench(dir, selffn, 0, 0);
+    bench(dir, selffn, 40, 30);
+
+    test_rmtree(dir);
+    free(dir);
+    return test_done("bench_decrypt");
+}
@@ -0,0 +1,190 @@
+#include "ps4.h"
+#include "main.h"
+#include "dump.h"
+#include "path.h"
+#include "test.h"
+
+// Finding the SELFs in a tree of 50k files, the way decrypt_dir() walks it
+// now against the walk it replaced: a path formatted and stat()ed per
+// entry, then every regular file opened, stat()ed again and mapped 16 KiB
+// read-write to look at two magics. Only the classification is timed, no
+// SELF is decrypted. The tree is walked once first so that every run finds
+// it in the cache.
+
+#define DIRS  50
+#define FILES 1000
+#define SIZE  0x800
+#define PT_LOAD 1
+
+static const char *exts[] = { ".png", ".dds", ".at9", ".gnf", ".bin", ".dat", ".pak", ".sdat", ".wav", ".json" };
+
+static int old_is_self(const char *fn)
+{
+    struct stat st;
+    int res = 0;
+    int fd = open(fn, O_RDONLY, 0);
+    if (fd != -1) {
+        stat(fn, &st);
+        void *addr = mmap(0, 0x4000, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            if (st.st_size >= 4)
+            {
+                uint32_t selfMagic = *(uint32_t*)((uint8_t*)addr + 0x00);
+                if (selfMagic == SELF_MAGIC)
+                {
+                    uint16_t snum = *(uint16_t*)((uint8_t*)addr + 0x18);
+                    if (st.st_size >= (0x20 + snum * 0x20 + 4))
+                    {
+                        uint32_t elfMagic = *(uint32_t*)((uint8_t*)addr + 0x20 + snum * 0x20);
+                        if ((selfMagic == SELF_MAGIC) && (elfMagic == ELF_MAGIC))
+                            res = 1;
+                    }
+                }
+            }
+            munmap(addr, 0x4000);
+        }
+        close(fd);
+    }
+    return res;
+}
+
+static int old_walk(const char *sourcedir, uint32_t *calls)
+{
+    char src_path[1024];
+    struct stat info;
+    struct dirent *dp;
+    int found = 0;
+
+    DIR *dir = opendir(sourcedir);
+    *calls += 2;
+    if (!dir)
+        return 0;
+    while ((dp = readdir(dir)) != NULL)
+    {
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        snprintf(src_path, sizeof(src_path), "%s/%s", sourcedir, dp->d_name);
+        *calls += 1;
+        if (!stat(src_path, &info))
+        {
+            if (S_ISDIR(info.st_mode))
+                found += old_walk(src_path, calls);
+            else
+            if (S_ISREG(info.st_mode))
+            {
+                found += old_is_self(src_path);
+                *calls += 5;
+            }
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+// scan_dir() without the queue and the output tree.
+static int new_walk(path_t *src, stats_t *st)
+{
+    struct dirent *dp;
+    struct stat info;
+    int found = 0;
+
+    DIR *dir = opendir(src->buf);
+    stats_io(st, 1, 0, 0);
+    if (!dir)
+        return 0;
+    while ((dp = readdir(dir)) != NULL)
+    {
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        size_t len = path_push(src, dp->d_name);
+        int type = dp->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            stats_io(st, 1, 0, 0);
+            if (!stat(src->buf, &info))
+                type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR)
+            found += new_walk(src, st);
+        else
+        if (type == DT_REG)
+            found += !(config.skip_assets && is_asset_name(dp->d_name)) && is_self(src->buf, st);
+        path_pop(src, len);
+    }
+    closedir(dir);
+    stats_io(st, 1, 0, 0);
+    return found;
+}
+
+static void report(const char *name, uint64_t us, uint32_t calls, int found)
+{
+    printf("  %-26s %5llu ms  %5.2f calls/file  %d SELFs\n", name, (unsigned long long)(us / 1000),
+           (double)calls / (DIRS * FILES), found);
+}
+
+static void run_old(const char *tree)
+{
+    uint32_t calls = 0;
+    uint64_t start = stats_now();
+    int found = old_walk(tree, &calls);
+    report("before: stat + mmap", stats_now() - start, calls, found);
+    CHECK(found == DIRS);
+}
+
+static void run_new(const char *tree, int skip_assets)
+{
+    path_t src;
+    stats_t st;
+    memset(&st, 0, sizeof(st));
+    config.skip_assets = skip_assets;
+    path_init(&src, tree);
+    uint64_t start = stats_now();
+    int found = new_walk(&src, &st);
+    report(skip_assets ? "after: skip_assets=1" : "after: header read", stats_now() - start, st.calls, found);
+    CHECK(found == DIRS);
+    path_free(&src);
+    config.skip_assets = 0;
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char tree[256], fn[320];
+    uint8_t data[SIZE];
+    size_t self_size;
+    uint32_t calls = 0;
+
+    const test_self_segment_t seg = { { PT_LOAD, 5, 0x4000, 0, 0, 0x1000, 0x1000, 0x4000 }, SELF_ENTRY_ENCRYPTED, 0 };
+    uint8_t *self = test_self_image(&seg, 1, &self_size);
+
+    snprintf(tree, sizeof(tree), "%s/tree", dir);
+    mkdir(tree, 0777);
+    for (int d = 0; d < DIRS; d++)
+    {
+        snprintf(fn, sizeof(fn), "%s/dir%02d", tree, d);
+        mkdir(fn, 0777);
+        for (int f = 0; f < FILES; f++)
+        {
+            if (f == FILES / 2)
+            {
+                snprintf(fn, sizeof(fn), "%s/dir%02d/module%d.prx", tree, d, f);
+                test_write_file(fn, self, self_size);
+                continue;
+            }
+            snprintf(fn, sizeof(fn), "%s/dir%02d/file%04d%s", tree, d, f, exts[f % 10]);
+            test_fill(data, sizeof(data), d * FILES + f);
+            test_write_file(fn, data, sizeof(data));
+        }
+    }
+
+    printf("bench_scan: %d files in %d directories\n", DIRS * FILES, DIRS);
+    old_walk(tree, &calls);
+    run_old(tree);
+    run_new(tree, 0);
+    run_new(tree, 1);
+
+    free(self);
+    test_rmtree(dir);
+    free(dir);
+    return test_done("bench_scan");
+}
@@ -0,0 +1,154 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "unpfs.h"
+#include "dump.h"
+#include "stage.h"
+#include "test.h"
+
+// App and patch of a split dump, images and SELFs, run through
+// stage_run_all() the way dump_game() does now and chained one after the
+// other in the order dump_game() used to take them: app image, patch image,
+// app SELFs, patch SELFs. With decryption slower than the USB disk the
+// image copies fill the disk while the SELFs wait on the decryptor. The
+// disk can't go faster than the 42 MiB written at its own speed.
+
+#define PT_LOAD  1
+#define SEG_SIZE 0x600000
+#define PLAIN    0x200000
+
+enum { APP_PFS, PATCH_PFS, APP_SELF, PATCH_SELF, NUM_STAGES };
+
+typedef struct {
+    char pfs[128];
+    char out[128];
+    char selfs[2][128];
+    int nselfs;
+    int patch;
+} Tree;
+
+static void stage_pfs(void *arg)
+{
+    Tree *t = (Tree *)arg;
+    if (t->patch)
+        CHECK(unpfs(t->pfs, t->out, NULL) == 0);
+    else
+        CHECK(unpfs_merge(t->pfs, NULL, t->out, NULL, NULL) == 0);
+}
+
+static void stage_self(void *arg)
+{
+    Tree *t = (Tree *)arg;
+    char out[160];
+    for (int i = 0; i < t->nselfs; i++)
+    {
+        snprintf(out, sizeof(out), "%s/module%d.elf", t->out, i);
+        CHECK(decrypt_and_dump_self(t->selfs[i], out) == 0);
+    }
+}
+
+static uint64_t run(const char *dir, Tree *trees, int chained)
+{
+    stage_t stages[NUM_STAGES];
+    stats_t st[NUM_STAGES];
+    char name[32];
+
+    snprintf(name, sizeof(name), "CUSA0000%d", chained);
+    io_init((char *)dir, name, config.io_writers);
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(trees[i].out, sizeof(trees[i].out), "%s/%s-%s", dir, name, i ? "patch" : "app");
+        mkdir(trees[i].out, 0777);
+    }
+
+    memset(stages, 0, sizeof(stages));
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        stages[i].name = (i == APP_PFS) ? "app_pfs" : (i == PATCH_PFS) ? "patch_pfs" : (i == APP_SELF) ? "app_self" : "patch_self";
+        stages[i].run = (i <= PATCH_PFS) ? stage_pfs : stage_self;
+        stages[i].arg = &trees[i & 1];
+        stages[i].enabled = 1;
+        stages[i].stats = &st[i];
+        if (chained && i)
+            stages[i].deps[stages[i].ndeps++] = i - 1;
+    }
+
+    uint64_t start = stats_now();
+    stage_run_all(stages, NUM_STAGES);
+    uint64_t us = stats_now() - start;
+    CHECK(io_fini() == 0);
+    if (!chained)
+    {
+        for (int i = 0; i < NUM_STAGES; i++)
+            printf("    %-10s done at %5llu ms\n", st[i].name, (unsigned long long)((st[i].started + st[i].elapsed - start) / 1000));
+    }
+    return us;
+}
+
+static void bench(const char *dir, Tree *trees, int decrypt_mbs, int usb_mbs, int writers)
+{
+    host_decrypt_usec = decrypt_mbs ? 1000000 / decrypt_mbs : 0;
+    host_write_usec = usb_mbs ? 1000000 / usb_mbs : 0;
+    config.io_writers = writers;
+    if (decrypt_mbs)
+        printf("decryption %d MiB/s, USB disk %d MiB/s, io_writers=%d:\n", decrypt_mbs, usb_mbs, writers);
+    else
+        printf("no simulated delays, io_writers=%d:\n", writers);
+
+    uint64_t before = run(dir, trees, 1);
+    printf("  before: one stage at a time  %5llu ms\n", (unsigned long long)(before / 1000));
+    uint64_t after = run(dir, trees, 0);
+    printf("  after: stages side by side   %5llu ms\n", (unsigned long long)(after / 1000));
+    host_decrypt_usec = host_write_usec = 0;
+}
+
+static void build(const char *dir, Tree *t, const char *name, int nplain, int nselfs)
+{
+    test_pfs_file_t files[8];
+    char names[8][32];
+    test_self_segment_t seg;
+
+    uint8_t *plain = malloc(PLAIN);
+    test_fill(plain, PLAIN, nplain);
+    for (int i = 0; i < nplain; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "data/file%d.bin", i);
+        files[i] = (test_pfs_file_t){ names[i], plain, PLAIN };
+    }
+    snprintf(t->pfs, sizeof(t->pfs), "%s/%s.dat", dir, name);
+    CHECK(test_pfs_build(t->pfs, files, nplain) > 0);
+    free(plain);
+
+    memset(&seg, 0, sizeof(seg));
+    seg.phdr = (Elf64_Phdr){ PT_LOAD, 5, 0x4000, 0, 0, SEG_SIZE, SEG_SIZE, 0x4000 };
+    seg.props = SELF_ENTRY_ENCRYPTED;
+    t->nselfs = nselfs;
+    for (int i = 0; i < nselfs; i++)
+    {
+        snprintf(t->selfs[i], sizeof(t->selfs[i]), "%s/%s-module%d.prx", dir, name, i);
+        CHECK(test_self_build(t->selfs[i], &seg, 1) > 0);
+    }
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    Tree trees[2];
+
+    memset(trees, 0, sizeof(trees));
+    build(dir, &trees[0], "app", 8, 2);
+    build(dir, &trees[1], "patch", 4, 1);
+    trees[1].patch = 1;
+    config.split = 1;
+    config.decrypt_queue = 4;
+    config.decrypt_window = 1024;
+
+    printf("bench_stages: images of 16 and 8 MiB, SELFs of 12 and 6 MiB\n");
+    bench(dir, trees, 0, 0, 2);
+    bench(dir, trees, 20, 30, 2);
+    bench(dir, trees, 20, 30, 1);
+
+    test_rmtree(dir);
+    free(dir);
+    return test_done("bench_stages");
+}
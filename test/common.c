@@ -0,0 +1,93 @@
+#include "ps4.h"
+#include "test.h"
+
+int test_failures;
+
+char *test_tmpdir(void)
+{
+    char *dir = strdup("/tmp/dumper-test.XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return dir;
+}
+
+void test_rmtree(const char *path)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+    if (system(cmd) != 0)
+        fprintf(stderr, "cannot remove %s\n", path);
+}
+
+int test_done(const char *name)
+{
+    if (test_failures)
+    {
+        printf("%s: %d checks failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+// Data that doesn't repeat within a file and differs between seeds.
+void test_fill(void *buf, size_t size, uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        ((uint8_t *)buf)[i] = (uint8_t)x;
+    }
+}
+
+int test_write_file(const char *path, const void *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return -1;
+    size_t done = fwrite(data, 1, size, f);
+    fclose(f);
+    return (done == size) ? 0 : -1;
+}
+
+void *test_read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(len + 1);
+    *size = fread(data, 1, len, f);
+    fclose(f);
+    return data;
+}
+
+int test_file_equals(const char *path, const void *data, size_t size)
+{
+    size_t got;
+    void *buf = test_read_file(path, &got);
+    if (buf == NULL)
+    {
+        fprintf(stderr, "%s: missing\n", path);
+        return 0;
+    }
+    int same = (got == size) && !memcmp(buf, data, size);
+    if (!same)
+        fprintf(stderr, "%s: %zu bytes, %zu expected%s\n", path, got, size, (got == size) ? ", contents differ" : "");
+    free(buf);
+    return same;
+}
+
+int test_exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
@@ -0,0 +1,270 @@
+#include "ps4.h"
+#include "main.h"
+#include "test.h"
+
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/statfs.h>
+
+#undef mmap
+#undef munmap
+#undef syscall
+#undef write
+
+// main.c isn't part of the tests, the configuration is theirs to set.
+configuration config;
+
+int host_fail_segment = -1;
+
+int host_decrypt_usec;
+int host_write_usec;
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t until;
+} host_device_t;
+
+static host_device_t host_decryptor = { PTHREAD_MUTEX_INITIALIZER, 0 };
+static host_device_t host_disk = { PTHREAD_MUTEX_INITIALIZER, 0 };
+
+// A device busy for len bytes at usec per MiB. Requests are served one at
+// a time in the order they come in: each takes the next free slot of the
+// device and returns at its end.
+static void host_busy(host_device_t *dev, int usec, size_t len)
+{
+    if (usec == 0)
+        return;
+    pthread_mutex_lock(&dev->lock);
+    uint64_t now = stats_now();
+    if (dev->until < now)
+        dev->until = now;
+    dev->until += (uint64_t)len * usec >> 20;
+    uint64_t end = dev->until;
+    pthread_mutex_unlock(&dev->lock);
+    if (end > now)
+        usleep(end - now);
+}
+
+int scePthreadCreate(ScePthread *thread, const ScePthreadAttr *attr, void *(*entry)(void *), void *arg, const char *name)
+{
+    pthread_t t;
+    int res = pthread_create(&t, NULL, entry, arg);
+    *thread = (ScePthread)t;
+    return res;
+}
+
+int scePthreadJoin(ScePthread thread, void **value)
+{
+    return pthread_join((pthread_t)thread, value);
+}
+
+ScePthread scePthreadSelf(void)
+{
+    return (ScePthread)pthread_self();
+}
+
+void scePthreadYield(void)
+{
+    sched_yield();
+}
+
+int scePthreadMutexInit(ScePthreadMutex *mutex, const ScePthreadMutexattr *attr, const char *name)
+{
+    *mutex = malloc(sizeof(pthread_mutex_t));
+    return pthread_mutex_init(*mutex, NULL);
+}
+
+int scePthreadMutexDestroy(ScePthreadMutex *mutex)
+{
+    pthread_mutex_destroy(*mutex);
+    free(*mutex);
+    return 0;
+}
+
+int scePthreadMutexLock(ScePthreadMutex *mutex)
+{
+    return pthread_mutex_lock(*mutex);
+}
+
+int scePthreadMutexUnlock(ScePthreadMutex *mutex)
+{
+    return pthread_mutex_unlock(*mutex);
+}
+
+int scePthreadCondInit(ScePthreadCond *cond, const ScePthreadCondattr *attr, const char *name)
+{
+    *cond = malloc(sizeof(pthread_cond_t));
+    return pthread_cond_init(*cond, NULL);
+}
+
+int scePthreadCondDestroy(ScePthreadCond *cond)
+{
+    pthread_cond_destroy(*cond);
+    free(*cond);
+    return 0;
+}
+
+int scePthreadCondWait(ScePthreadCond *cond, ScePthreadMutex *mutex)
+{
+    return pthread_cond_wait(*cond, *mutex);
+}
+
+int scePthreadCondTimedwait(ScePthreadCond *cond, ScePthreadMutex *mutex, SceKernelUseconds usec)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += usec / 1000000;
+    ts.tv_nsec += (usec % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(*cond, *mutex, &ts);
+}
+
+int scePthreadCondSignal(ScePthreadCond *cond)
+{
+    return pthread_cond_signal(*cond);
+}
+
+int scePthreadCondBroadcast(ScePthreadCond *cond)
+{
+    return pthread_cond_broadcast(*cond);
+}
+
+unsigned int sceKernelSleep(unsigned int seconds)
+{
+    return sleep(seconds);
+}
+
+int sceKernelUsleep(SceKernelUseconds microseconds)
+{
+    return usleep(microseconds);
+}
+
+int sceNetSocket(const char *name, int family, int type, int protocol)
+{
+    return socket(family, type, protocol);
+}
+
+int sceNetSocketClose(int s)
+{
+    return close(s);
+}
+
+int sceNetConnect(int s, struct sockaddr *addr, int addrlen)
+{
+    return connect(s, addr, addrlen);
+}
+
+int sceNetSend(int s, const void *buf, size_t len, int flags)
+{
+    return send(s, buf, len, flags | MSG_NOSIGNAL);
+}
+
+int sceNetSetsockopt(int s, int level, int optname, const void *optval, unsigned int optlen)
+{
+    return setsockopt(s, level, optname, optval, optlen);
+}
+
+int sceNetInetPton(int af, const char *src, void *dst)
+{
+    return inet_pton(af, src, dst);
+}
+
+uint16_t sceNetHtons(uint16_t host16)
+{
+    return htons(host16);
+}
+
+int sceSysUtilSendSystemNotificationWithText(int type, char *message)
+{
+    if (getenv("TEST_VERBOSE"))
+        printf("[notify] %s\n", message);
+    return 0;
+}
+
+void initNetwork(void)
+{
+}
+
+// A decrypting mapping of segment n at offset o (offset n << 32 | o) reads
+// as the bytes (n * 37 + o + i) & 0xff, see test_self_byte().
+void *host_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+    if (!(flags & 0x80000))
+        return mmap(addr, len, prot, flags, fd, offset);
+
+    uint32_t seg = (uint64_t)offset >> 32;
+    uint32_t off = (uint64_t)offset & 0xFFFFFFFF;
+    if ((int)seg == host_fail_segment)
+        return MAP_FAILED;
+    uint8_t *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return p;
+    for (size_t i = 0; i < len; i++)
+        p[i] = test_self_byte(seg, off + i);
+    host_busy(&host_decryptor, host_decrypt_usec, len);
+    return p;
+}
+
+int host_munmap(void *addr, size_t len)
+{
+    return munmap(addr, len);
+}
+
+ssize_t host_write(int fd, const void *buf, size_t size)
+{
+    ssize_t res = write(fd, buf, size);
+    if (res > 0)
+        host_busy(&host_disk, host_write_usec, res);
+    return res;
+}
+
+// The kernel's struct statfs as io.c reads it.
+static long host_statfs(const char *path, uint64_t *out)
+{
+    struct statfs st;
+    if (statfs(path, &st))
+        return -1;
+    memset(out, 0, 64);
+    out[2] = st.f_bsize;
+    out[5] = st.f_blocks;
+    out[6] = st.f_bfree;
+    out[7] = st.f_bavail;
+    return 0;
+}
+
+long host_syscall(long number, ...)
+{
+    va_list ap;
+    va_start(ap, number);
+    long a = va_arg(ap, long);
+    long b = va_arg(ap, long);
+    long c = va_arg(ap, long);
+    long d = va_arg(ap, long);
+    va_end(ap);
+
+    switch (number)
+    {
+    case 9:
+        return link((char *)a, (char *)b);
+    case 95:
+        return fsync(a);
+    case 128:
+        return rename((char *)a, (char *)b);
+    case 232:
+        return clock_gettime(CLOCK_MONOTONIC, (struct timespec *)b);
+    case 396:
+        return host_statfs((char *)a, (uint64_t *)b);
+    case 475:
+        return pread(a, (void *)b, c, d);
+    case 476:
+        return pwrite(a, (void *)b, c, d);
+    }
+    fprintf(stderr, "host: syscall %ld not supported\n", number);
+    return -1;
+}
@@ -0,0 +1,10 @@
+#ifndef LIBC_H
+#define LIBC_H
+
+// Stand-in for libPS4's libc.h, for sources that need nothing else of it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef PS4_H
+#define PS4_H
+
+// Stand-in for libPS4 so the payload sources build and run on Linux for the
+// tests. libc comes from the host, the Sce calls and the raw syscalls the
+// payload uses are implemented in host.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "types.h"
+
+typedef void *ScePthread;
+typedef void *ScePthreadAttr;
+typedef void *ScePthreadMutex;
+typedef void *ScePthreadMutexattr;
+typedef void *ScePthreadCond;
+typedef void *ScePthreadCondattr;
+typedef unsigned int SceKernelUseconds;
+
+int scePthreadCreate(ScePthread *thread, const ScePthreadAttr *attr, void *(*entry)(void *), void *arg, const char *name);
+int scePthreadJoin(ScePthread thread, void **value);
+ScePthread scePthreadSelf(void);
+void scePthreadYield(void);
+int scePthreadMutexInit(ScePthreadMutex *mutex, const ScePthreadMutexattr *attr, const char *name);
+int scePthreadMutexDestroy(ScePthreadMutex *mutex);
+int scePthreadMutexLock(ScePthreadMutex *mutex);
+int scePthreadMutexUnlock(ScePthreadMutex *mutex);
+int scePthreadCondInit(ScePthreadCond *cond, const ScePthreadCondattr *attr, const char *name);
+int scePthreadCondDestroy(ScePthreadCond *cond);
+int scePthreadCondWait(ScePthreadCond *cond, ScePthreadMutex *mutex);
+int scePthreadCondTimedwait(ScePthreadCond *cond, ScePthreadMutex *mutex, SceKernelUseconds usec);
+int scePthreadCondSignal(ScePthreadCond *cond);
+int scePthreadCondBroadcast(ScePthreadCond *cond);
+
+unsigned int sceKernelSleep(unsigned int seconds);
+int sceKernelUsleep(SceKernelUseconds microseconds);
+
+int sceNetSocket(const char *name, int family, int type, int protocol);
+int sceNetSocketClose(int s);
+int sceNetConnect(int s, struct sockaddr *addr, int addrlen);
+int sceNetSend(int s, const void *buf, size_t len, int flags);
+int sceNetSetsockopt(int s, int level, int optname, const void *optval, unsigned int optlen);
+int sceNetInetPton(int af, const char *src, void *dst);
+uint16_t sceNetHtons(uint16_t host16);
+
+int sceSysUtilSendSystemNotificationWithText(int type, char *message);
+
+void initNetwork(void);
+
+// The kernel's sockaddr_in has a length byte, Linux doesn't.
+#define sin_len sin_zero[7]
+
+// mmap with flag 0x80000 is how the payload has SELF segments decrypted,
+// host.c fakes that. The syscalls go to their Linux counterparts.
+void *host_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int host_munmap(void *addr, size_t len);
+long host_syscall(long number, ...);
+
+// Writes go through host.c to take the time of a simulated USB disk.
+// Function-like, members named write are left alone.
+ssize_t host_write(int fd, const void *buf, size_t size);
+
+#define mmap host_mmap
+#define munmap host_munmap
+#define syscall host_syscall
+#define write(fd, buf, size) host_write(fd, buf, size)
+
+#endif
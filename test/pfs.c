@@ -0,0 +1,152 @@
+#include "ps4.h"
+#include "unpfs.h"
+#include "test.h"
+
+// Image layout: the header in block 0, the inode table from block 1, then
+// the data of every inode, contiguous. Inode 0 is the super root, holding
+// the single entry "uroot", the root of the tree.
+
+#define PFS_MAX_NODES 512
+
+typedef struct {
+    char path[256];
+    int parent;
+    int dir;
+    const void *data;
+    size_t size;
+    uint8_t *body;
+    size_t bodylen;
+    uint32_t db;
+    uint32_t blocks;
+} pfs_node_t;
+
+static pfs_node_t nodes[PFS_MAX_NODES];
+static int nnodes;
+
+static int node_add(const char *path, int parent, int dir)
+{
+    pfs_node_t *n = &nodes[nnodes];
+    memset(n, 0, sizeof(pfs_node_t));
+    snprintf(n->path, sizeof(n->path), "%s", path);
+    n->parent = parent;
+    n->dir = dir;
+    return nnodes++;
+}
+
+static int dir_node(const char *path)
+{
+    if (path[0] == '\0')
+        return 1;
+    for (int i = 2; i < nnodes; i++)
+        if (nodes[i].dir && !strcmp(nodes[i].path, path))
+            return i;
+
+    char parent[256];
+    snprintf(parent, sizeof(parent), "%s", path);
+    char *slash = strrchr(parent, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        parent[0] = '\0';
+    int p = dir_node(parent);
+    return node_add(path, p, 1);
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void dirent_add(pfs_node_t *d, uint32_t ino, uint32_t type, const char *name)
+{
+    uint32_t namelen = strlen(name);
+    uint32_t entsize = (sizeof(struct dirent_t) + namelen + 1 + 7) & ~7;
+    d->body = realloc(d->body, d->bodylen + entsize);
+    struct dirent_t *ent = (struct dirent_t *)(d->body + d->bodylen);
+    memset(ent, 0, entsize);
+    ent->ino = ino;
+    ent->type = type;
+    ent->namelen = namelen;
+    ent->entsize = entsize;
+    memcpy(ent + 1, name, namelen);
+    d->bodylen += entsize;
+}
+
+void *test_pfs_image(const test_pfs_file_t *files, int num, size_t *size)
+{
+    nnodes = 0;
+    node_add("", -1, 1);
+    node_add("", 0, 1);
+    for (int i = 0; i < num; i++)
+    {
+        char parent[256];
+        snprintf(parent, sizeof(parent), "%s", files[i].name);
+        char *slash = strrchr(parent, '/');
+        if (slash != NULL)
+            *slash = '\0';
+        else
+            parent[0] = '\0';
+        int p = dir_node(parent);
+        int n = node_add(files[i].name, p, 0);
+        nodes[n].data = files[i].data;
+        nodes[n].size = files[i].size;
+    }
+
+    dirent_add(&nodes[0], 1, 3, "uroot");
+    for (int i = 2; i < nnodes; i++)
+        dirent_add(&nodes[nodes[i].parent], i, nodes[i].dir ? 3 : 2, base_name(nodes[i].path));
+
+    uint32_t per = TEST_PFS_BLOCK / sizeof(struct di_d32);
+    uint32_t ninb = (nnodes + per - 1) / per;
+    uint32_t next = 1 + ninb;
+    for (int i = 0; i < nnodes; i++)
+    {
+        pfs_node_t *n = &nodes[i];
+        size_t len = n->dir ? n->bodylen : n->size;
+        n->db = next;
+        n->blocks = len ? (len + TEST_PFS_BLOCK - 1) / TEST_PFS_BLOCK : 1;
+        next += n->blocks;
+    }
+
+    *size = (size_t)next * TEST_PFS_BLOCK;
+    uint8_t *img = calloc(1, *size);
+
+    struct pfs_header_t *hdr = (struct pfs_header_t *)img;
+    hdr->version = 1;
+    hdr->magic = 20130315;
+    hdr->blocksz = TEST_PFS_BLOCK;
+    hdr->nblock = next;
+    hdr->ndinode = nnodes;
+    hdr->ndblock = next - 1 - ninb;
+    hdr->ndinodeblock = ninb;
+    hdr->superroot_ino = 0;
+
+    for (int i = 0; i < nnodes; i++)
+    {
+        pfs_node_t *n = &nodes[i];
+        struct di_d32 *ino = (struct di_d32 *)(img + TEST_PFS_BLOCK * (1 + i / per) + sizeof(struct di_d32) * (i % per));
+        ino->mode = n->dir ? 0x4000 : 0x8000;
+        ino->nlink = 1;
+        ino->size = n->dir ? n->bodylen : n->size;
+        ino->size_compressed = ino->size;
+        ino->blocks = n->blocks;
+        ino->db[0] = n->db;
+        if (n->dir)
+            memcpy(img + (size_t)n->db * TEST_PFS_BLOCK, n->body, n->bodylen);
+        else
+        if (n->size)
+            memcpy(img + (size_t)n->db * TEST_PFS_BLOCK, n->data, n->size);
+        free(n->body);
+    }
+    return img;
+}
+
+size_t test_pfs_build(const char *path, const test_pfs_file_t *files, int num)
+{
+    size_t size;
+    void *img = test_pfs_image(files, num, &size);
+    int res = test_write_file(path, img, size);
+    free(img);
+    return res ? 0 : size;
+}
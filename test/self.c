@@ -0,0 +1,106 @@
+#include "ps4.h"
+#include "dump.h"
+#include "test.h"
+
+// File layout: the SELF header, two entries (hashes, then data) for every
+// segment that has one, the ELF header and phdrs, then from SELF_HEADER_MAX
+// on the stored segments, and at the very end the data of the segments
+// without an entry, like the version segment.
+
+size_t test_self_header(const test_self_segment_t *segs, int num)
+{
+    int nentries = 0;
+    for (int i = 0; i < num; i++)
+        if (segs[i].props)
+            nentries += 2;
+    return sizeof(struct self_header_t) + nentries * sizeof(struct self_entry_t) + sizeof(Elf64_Ehdr) + num * sizeof(Elf64_Phdr);
+}
+
+void *test_self_image(const test_self_segment_t *segs, int num, size_t *size)
+{
+    size_t header = test_self_header(segs, num);
+    uint64_t data = (header > SELF_HEADER_MAX) ? (header + 0xF) & ~0xF : SELF_HEADER_MAX;
+    uint64_t tail = 0;
+    uint64_t end = data;
+    for (int i = 0; i < num; i++)
+    {
+        uint64_t stored = segs[i].selfsz ? segs[i].selfsz : segs[i].phdr.p_filesz;
+        if (segs[i].props)
+            end = (end + stored + 0xF) & ~0xF;
+        else
+            tail += segs[i].phdr.p_filesz;
+    }
+    *size = end + tail;
+
+    uint8_t *self = calloc(1, *size);
+    struct self_header_t *hdr = (struct self_header_t *)self;
+    hdr->magic = SELF_MAGIC;
+    hdr->version = 0;
+    hdr->mode = 1;
+    hdr->endian = 1;
+    hdr->header_size = header;
+    hdr->file_size = *size;
+
+    struct self_entry_t *entries = (struct self_entry_t *)(self + sizeof(struct self_header_t));
+    int n = 0;
+    uint64_t offset = data;
+    uint64_t tailoff = end;
+    for (int i = 0; i < num; i++)
+    {
+        uint64_t filesz = segs[i].phdr.p_filesz;
+        if (!segs[i].props)
+        {
+            for (uint64_t k = 0; k < filesz; k++)
+                self[tailoff + k] = test_self_byte(i, k);
+            tailoff += filesz;
+            continue;
+        }
+
+        uint64_t stored = segs[i].selfsz ? segs[i].selfsz : filesz;
+        entries[n].props = SELF_ENTRY_SIGNED | ((uint64_t)(i + 1) << 20);
+        entries[n].offset = 0;
+        entries[n].filesz = 0x20;
+        entries[n].memsz = 0x20;
+        n++;
+        entries[n].props = segs[i].props | SELF_ENTRY_BLOCKED | ((uint64_t)i << 20);
+        entries[n].offset = offset;
+        entries[n].filesz = stored;
+        entries[n].memsz = filesz;
+        n++;
+
+        // Decrypting mappings read as test_self_byte(), stored segments
+        // hold the same bytes so both paths give the same ELF.
+        for (uint64_t k = 0; k < stored; k++)
+            self[offset + k] = test_self_byte(i, k);
+        offset = (offset + stored + 0xF) & ~0xF;
+    }
+    hdr->num_entries = n;
+
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)(entries + n);
+    *(uint32_t *)ehdr->e_ident = ELF_MAGIC;
+    ehdr->e_ident[4] = 2;
+    ehdr->e_ident[5] = 1;
+    ehdr->e_ident[6] = 1;
+    ehdr->e_type = 0xFE10;
+    ehdr->e_machine = 62;
+    ehdr->e_version = 1;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = num;
+
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)(ehdr + 1);
+    for (int i = 0; i < num; i++)
+        phdrs[i] = segs[i].phdr;
+
+    return self;
+}
+
+size_t test_self_build(const char *path, const test_self_segment_t *segs, int num)
+{
+    size_t size;
+    void *self = test_self_image(segs, num, &size);
+    int res = test_write_file(path, self, size);
+    free(self);
+    return res ? 0 : size;
+}
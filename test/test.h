@@ -0,0 +1,69 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "types.h"
+#include "dump.h"
+
+// Checks report the failing line and go on, test_done() gives the exit code.
+extern int test_failures;
+
+#define CHECK(cond) do {\
+    if (!(cond)) {\
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);\
+        test_failures++;\
+    }\
+} while (0)
+
+// Set by a test to make decrypting mappings of that segment fail.
+extern int host_fail_segment;
+
+// Speeds of the simulated decryption and USB disk for the benchmarks, in
+// microseconds per MiB, 0 (the default) for no delay. Each of them handles
+// one request at a time.
+extern int host_decrypt_usec;
+extern int host_write_usec;
+
+static inline uint8_t test_self_byte(uint32_t seg, uint64_t offset)
+{
+    return (uint8_t)(seg * 37 + offset);
+}
+
+char *test_tmpdir(void);
+void test_rmtree(const char *path);
+int test_done(const char *name);
+
+void test_fill(void *buf, size_t size, uint32_t seed);
+int test_write_file(const char *path, const void *data, size_t size);
+void *test_read_file(const char *path, size_t *size);
+int test_file_equals(const char *path, const void *data, size_t size);
+int test_exists(const char *path);
+
+// A PFS image like pfs_image.dat with the given files, directories are
+// made for every parent. Returns the image size, 0 on error.
+typedef struct {
+    const char *name;
+    const void *data;
+    size_t size;
+} test_pfs_file_t;
+
+#define TEST_PFS_BLOCK 0x1000
+
+size_t test_pfs_build(const char *path, const test_pfs_file_t *files, int num);
+void *test_pfs_image(const test_pfs_file_t *files, int num, size_t *size);
+
+// A SELF with the given phdrs. Segments with entry props get a hash and a
+// data entry, the data is stored in the file when the props don't encrypt
+// it, selfsz (0: p_filesz) is the stored size. Segments without props have
+// their data appended at the end of the file. Every byte k of segment i,
+// stored or decrypted, is test_self_byte(i, k).
+typedef struct {
+    Elf64_Phdr phdr;
+    uint64_t props;
+    uint64_t selfsz;
+} test_self_segment_t;
+
+size_t test_self_header(const test_self_segment_t *segs, int num);
+void *test_self_image(const test_self_segment_t *segs, int num, size_t *size);
+size_t test_self_build(const char *path, const test_self_segment_t *segs, int num);
+
+#endif
@@ -0,0 +1,229 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "unpfs.h"
+#include "unpkg.h"
+#include "test.h"
+
+#include <pthread.h>
+
+// A disc install simulated by a thread that copies app.pkg block by block,
+// package header first then in random order, mirrors the blocks of the PFS
+// image into pfs_image.dat and marks them in the bitmap. Extraction of the
+// package and the image has to come out the same as from a finished copy.
+
+#define BLOCK     0x1000
+#define IMAGE_OFF 0x10000
+#define TABLE_OFF 0x1000
+#define SFO_OFF   0x2000
+#define SFO_SIZE  0x321
+
+static char pkgfn[128], imagefn[128], mapfn[128];
+static uint8_t *pkg;
+static size_t pkgsize, imagesize, blocks;
+
+static uint32_t be32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static void build_pkg(uint8_t *sfo, const test_pfs_file_t *files, int num)
+{
+    uint8_t *image = test_pfs_image(files, num, &imagesize);
+    pkgsize = IMAGE_OFF + imagesize;
+    blocks = pkgsize / BLOCK;
+    pkg = calloc(1, pkgsize);
+
+    struct cnt_pkg_main_header *m = (struct cnt_pkg_main_header *)pkg;
+    m->magic = PS4_PKG_MAGIC;
+    m->table_entries_num = __builtin_bswap16(1);
+    m->file_table_offset = be32(TABLE_OFF);
+    struct cnt_pkg_content_header *c = (struct cnt_pkg_content_header *)(pkg + 0x400);
+    c->unk_0x410 = 0;
+    c->content_offset = be32(IMAGE_OFF);
+    c->content_size = be32(imagesize);
+    struct cnt_pkg_table_entry *e = (struct cnt_pkg_table_entry *)(pkg + TABLE_OFF);
+    e->type = be32(0x1000);
+    e->offset = be32(SFO_OFF);
+    e->size = be32(SFO_SIZE);
+    memcpy(pkg + SFO_OFF, sfo, SFO_SIZE);
+    memcpy(pkg + IMAGE_OFF, image, imagesize);
+    free(image);
+}
+
+static void copy_block(size_t b)
+{
+    int fd = open(pkgfn, O_WRONLY);
+    pwrite(fd, pkg + b * BLOCK, BLOCK, b * BLOCK);
+    close(fd);
+    if (b * BLOCK >= IMAGE_OFF)
+    {
+        fd = open(imagefn, O_WRONLY);
+        pwrite(fd, pkg + b * BLOCK, BLOCK, b * BLOCK - IMAGE_OFF);
+        close(fd);
+    }
+}
+
+// The install preallocates both files, the bitmap starts empty. The first
+// copied blocks are in, except missing.
+static void start_install_but(size_t copied, size_t missing)
+{
+    uint8_t *zero = calloc(1, pkgsize);
+    CHECK(test_write_file(pkgfn, zero, pkgsize) == 0);
+    CHECK(test_write_file(imagefn, zero, imagesize) == 0);
+    memset(zero, 0, BDCOPY_HEADER + blocks);
+    memset(zero + BDCOPY_HEADER, 1, copied);
+    if (missing < copied)
+        zero[BDCOPY_HEADER + missing] = 0;
+    CHECK(test_write_file(mapfn, zero, BDCOPY_HEADER + blocks) == 0);
+    free(zero);
+    for (size_t b = 0; b < copied; b++)
+        if (b != missing)
+            copy_block(b);
+}
+
+static void start_install(size_t copied)
+{
+    start_install_but(copied, blocks);
+}
+
+static void *copier_func(void *arg)
+{
+    size_t *order = malloc(sizeof(size_t) * blocks);
+    uint32_t x = 77;
+    for (size_t i = 0; i < blocks; i++)
+        order[i] = i;
+    for (size_t i = blocks - 1; i > 1; i--)
+    {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        size_t j = 1 + x % i;
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    int map = open(mapfn, O_WRONLY);
+    uint8_t one = 1;
+    for (size_t i = 0; i < blocks; i++)
+    {
+        copy_block(order[i]);
+        pwrite(map, &one, 1, BDCOPY_HEADER + order[i]);
+        usleep(3000);
+    }
+    close(map);
+    free(order);
+    return NULL;
+}
+
+static void check_tree(const char *out, uint8_t *sfo, const test_pfs_file_t *files, int num)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/sce_sys/param.sfo", out);
+    CHECK(test_file_equals(path, sfo, SFO_SIZE));
+    for (int i = 0; i < num; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", out, files[i].name);
+        CHECK(test_file_equals(path, files[i].data, files[i].size));
+    }
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char out[128];
+    uint8_t sfo[SFO_SIZE];
+    bdcopy_t bd;
+    stats_t st;
+
+    uint8_t *data = malloc(0x40000);
+    test_fill(data, 0x40000, 5);
+    test_fill(sfo, SFO_SIZE, 6);
+    test_pfs_file_t files[] = {
+        { "eboot.txt", data, 0x1234 },
+        { "data/a.bin", data + 0x2000, 0x18000 },
+        { "data/b.bin", data + 0x1A000, 0x800 },
+        { "data/sub/c.bin", data + 0x1B000, 0x20000 },
+        { "data/sub/d.bin", data + 0x3C000, 0x10 },
+    };
+    int num = (int)(sizeof(files) / sizeof(files[0]));
+    build_pkg(sfo, files, num);
+
+    snprintf(pkgfn, sizeof(pkgfn), "%s/app.pkg", dir);
+    snprintf(imagefn, sizeof(imagefn), "%s/pfs_image.dat", dir);
+    snprintf(mapfn, sizeof(mapfn), "%s/bdcopy.pbm", dir);
+    io_init(dir, "CUSA00000", 1);
+
+    // Ranges are taken in package offsets: the image starts at IMAGE_OFF,
+    // not at the start of the bitmap.
+    start_install(0);
+    int map = open(mapfn, O_WRONLY);
+    uint8_t ones[64];
+    memset(ones, 1, sizeof(ones));
+    pwrite(map, ones, imagesize / BLOCK, BDCOPY_HEADER + IMAGE_OFF / BLOCK);
+    close(map);
+    CHECK(bdcopy_open(&bd, mapfn) < 100);
+    CHECK(bdcopy_locate(&bd, pkgfn) == 0);
+    CHECK(bdcopy_ready(&bd, IMAGE_OFF, imagesize));
+    CHECK(!bdcopy_ready(&bd, 0, 0x400));
+    CHECK(!bdcopy_ready(&bd, IMAGE_OFF - 1, 2));
+    CHECK(!bdcopy_ready(&bd, pkgsize, 1));
+    bdcopy_close(&bd);
+
+    // Extraction while the copy runs.
+    start_install(1);
+    CHECK(bdcopy_open(&bd, mapfn) < 100);
+    CHECK(bdcopy_locate(&bd, pkgfn) == 0);
+    pthread_t copier;
+    pthread_create(&copier, NULL, copier_func, NULL);
+    snprintf(out, sizeof(out), "%s/CUSA00000", dir);
+    stats_start(&st, "bdcopy");
+    CHECK(unpfs_merge(imagefn, NULL, out, &bd, &st) == 0);
+    CHECK(unpkg(pkgfn, out, &bd, &st) == 0);
+    uint64_t image;
+    CHECK((bdcopy_image(&bd, &image) == 0) && (image == IMAGE_OFF));
+    pthread_join(copier, NULL);
+    CHECK(!bd.failed);
+    bdcopy_close(&bd);
+    check_tree(out, sfo, files, num);
+
+    // A copy that stops: everything waiting on it gives up.
+    start_install(1);
+    CHECK(bdcopy_open(&bd, mapfn) < 100);
+    CHECK(bdcopy_locate(&bd, pkgfn) == 0);
+    bd.stall = 1;
+    snprintf(out, sizeof(out), "%s/CUSA00000-stalled", dir);
+    CHECK(unpkg(pkgfn, out, &bd, &st) != 0);
+    CHECK(bd.failed);
+    CHECK(unpfs_merge(imagefn, NULL, out, &bd, &st) == -1);
+    CHECK(bdcopy_stalled(&bd));
+    bdcopy_close(&bd);
+
+    // Everything copied but the one block of a small file: only that file
+    // is held back, and the dump fails without it.
+    size_t missing = IMAGE_OFF / BLOCK;
+    while ((missing < blocks) && memcmp(pkg + missing * BLOCK, files[2].data, files[2].size))
+        missing++;
+    CHECK(missing < blocks);
+    start_install_but(blocks, missing);
+    CHECK(bdcopy_open(&bd, mapfn) < 100);
+    CHECK(bdcopy_locate(&bd, pkgfn) == 0);
+    bd.stall = 1;
+    snprintf(out, sizeof(out), "%s/CUSA00000-missing", dir);
+    CHECK(unpfs_merge(imagefn, NULL, out, &bd, &st) == -1);
+    bdcopy_close(&bd);
+    for (int i = 0; i < num; i++)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", out, files[i].name);
+        if (i == 2)
+            CHECK(!test_exists(path));
+        else
+            CHECK(test_file_equals(path, files[i].data, files[i].size));
+    }
+
+    io_fini();
+    free(pkg);
+    free(data);
+    test_rmtree(dir);
+    return test_done("test_bdcopy");
+}
@@ -0,0 +1,121 @@
+#include "ps4.h"
+#include "main.h"
+#include "cache.h"
+#include "io.h"
+#include "test.h"
+
+#include <pthread.h>
+
+// The module cache: keys from the header and size, one reservation per
+// missed key however many jobs miss it together, publishing and eviction.
+
+#define JOBS 8
+
+static char *dir;
+static cache_key_t shared;
+static pthread_barrier_t barrier;
+static int reservations;
+
+static void *job_func(void *arg)
+{
+    char out[128];
+    uint8_t buf[0x4000];
+    int reserved;
+    snprintf(out, sizeof(out), "%s/job%ld.elf", dir, (long)arg);
+    pthread_barrier_wait(&barrier);
+    if (cache_get(&shared, out, &reserved, buf, sizeof(buf)) && reserved)
+        __atomic_add_fetch(&reservations, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Stands in for decrypt_self() writing the module into the cache.
+static void fill(cache_key_t *key, const void *elf, size_t size)
+{
+    char path[128];
+    cache_path(key, path);
+    CHECK(test_write_file(path, elf, size) == 0);
+}
+
+int main(void)
+{
+    char module[128], out[128];
+    uint8_t buf[0x4000];
+    size_t size = 0x9000;
+    cache_key_t key, other;
+    int reserved;
+
+    dir = test_tmpdir();
+    config.cache_size = 1;
+    io_init(dir, "CUSA00000", 1);
+    cache_open(dir);
+    CHECK(cache_enabled());
+
+    uint8_t *self = malloc(size + 1);
+    test_fill(self, size, 1);
+    snprintf(module, sizeof(module), "%s/libSceFios2.sprx", dir);
+    CHECK(test_write_file(module, self, size) == 0);
+
+    // Same file, same key. The header and the size both count.
+    CHECK(cache_key(module, &shared, buf, sizeof(buf)) == 0);
+    CHECK(cache_key(module, &key, buf, sizeof(buf)) == 0);
+    CHECK(!memcmp(&key, &shared, sizeof(key)));
+    self[0x100] ^= 1;
+    CHECK(test_write_file(module, self, size) == 0);
+    CHECK(cache_key(module, &other, buf, sizeof(buf)) == 0);
+    CHECK(memcmp(&other, &shared, sizeof(key)));
+    self[0x100] ^= 1;
+    CHECK(test_write_file(module, self, size + 1) == 0);
+    CHECK(cache_key(module, &other, buf, sizeof(buf)) == 0);
+    CHECK((other.size == size + 1) && memcmp(&other, &shared, sizeof(key)));
+
+    // Jobs missing the same module together: one of them gets to cache it.
+    pthread_t threads[JOBS];
+    pthread_barrier_init(&barrier, NULL, JOBS);
+    for (long i = 0; i < JOBS; i++)
+        pthread_create(&threads[i], NULL, job_func, (void *)i);
+    for (int i = 0; i < JOBS; i++)
+        pthread_join(threads[i], NULL);
+    CHECK(reservations == 1);
+    CHECK(cache_misses == JOBS);
+
+    uint8_t *elf = malloc(0x90000);
+    test_fill(elf, 0x90000, 2);
+    fill(&shared, elf, 0x90000);
+    snprintf(out, sizeof(out), "%s/owner.elf", dir);
+    CHECK(cache_put(&shared, out, buf, sizeof(buf)) == 0);
+    CHECK(test_file_equals(out, elf, 0x90000));
+
+    snprintf(out, sizeof(out), "%s/hit.elf", dir);
+    CHECK(cache_get(&shared, out, &reserved, buf, sizeof(buf)) == 0);
+    CHECK(test_file_equals(out, elf, 0x90000));
+    CHECK(cache_hits == 1);
+
+    // A reservation given back can be taken again.
+    CHECK(cache_get(&other, out, &reserved, buf, sizeof(buf)) && reserved);
+    CHECK(cache_get(&other, out, &reserved, buf, sizeof(buf)) && !reserved);
+    cache_drop(&other);
+    CHECK(cache_get(&other, out, &reserved, buf, sizeof(buf)) && reserved);
+
+    // Over cache_size the least recently used entry goes.
+    fill(&other, elf, 0x90000);
+    snprintf(out, sizeof(out), "%s/other.elf", dir);
+    CHECK(cache_put(&other, out, buf, sizeof(buf)) == 0);
+    char path[128];
+    cache_path(&shared, path);
+    CHECK(!test_exists(path));
+    CHECK(cache_get(&shared, out, &reserved, buf, sizeof(buf)) && reserved);
+    cache_drop(&shared);
+
+    // Only completed entries are saved.
+    cache_close();
+    cache_open(dir);
+    CHECK(cache_get(&other, out, &reserved, buf, sizeof(buf)) == 0);
+    CHECK(cache_get(&shared, out, &reserved, buf, sizeof(buf)) && reserved);
+    cache_close();
+
+    io_fini();
+    free(elf);
+    free(self);
+    test_rmtree(dir);
+    return test_done("test_cache");
+}
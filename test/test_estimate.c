@@ -0,0 +1,63 @@
+#include "ps4.h"
+#include "main.h"
+#include "unpfs.h"
+#include "dump.h"
+#include "test.h"
+
+// unpfs_estimate() counts every file of the tree, SELFs at the size of the
+// ELF they decrypt to, including SELFs whose headers run past the probe.
+
+#define PT_LOAD 1
+#define WIDE_PHDRS 40
+
+static const test_self_segment_t segs[] = {
+    { { PT_LOAD, 5, 0x4000, 0, 0, 0x3000, 0x3000, 0x4000 }, SELF_ENTRY_ENCRYPTED, 0 },
+    { { PT_LOAD, 6, 0x8000, 0, 0, 0x1000, 0x1000, 0x4000 }, SELF_ENTRY_SIGNED, 0 },
+};
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char pfsfn[128];
+    size_t small_size, wide_size;
+    uint8_t plain[0x6000];
+
+    uint8_t *small = test_self_image(segs, 2, &small_size);
+    test_self_segment_t wide_segs[WIDE_PHDRS];
+    memset(wide_segs, 0, sizeof(wide_segs));
+    wide_segs[WIDE_PHDRS - 1].phdr = (Elf64_Phdr){ PT_LOAD, 5, 0x4000, 0, 0, 0x1000, 0x1000, 0x4000 };
+    CHECK(test_self_header(wide_segs, WIDE_PHDRS) > SELF_PROBE_SIZE);
+    uint8_t *wide = test_self_image(wide_segs, WIDE_PHDRS, &wide_size);
+    test_fill(plain, sizeof(plain), 3);
+
+    uint64_t small_elf = self_output_size(small, small_size, small_size);
+    uint64_t wide_elf = self_output_size(wide, wide_size, wide_size);
+    CHECK(small_elf > 0);
+    CHECK(wide_elf > 0);
+
+    test_pfs_file_t files[] = {
+        { "eboot.bin", small, small_size },
+        { "sce_module/libwide.prx", wide, wide_size },
+        { "data/plain.bin", plain, sizeof(plain) },
+        { "data/short.bin", plain, 0x20 },
+        { "data/empty.bin", plain, 0 },
+    };
+    uint64_t plain_bytes = sizeof(plain) + 0x20;
+    snprintf(pfsfn, sizeof(pfsfn), "%s/pfs_image.dat", dir);
+    CHECK(test_pfs_build(pfsfn, files, 5) > 0);
+
+    uint32_t num = 0;
+    CHECK(unpfs_estimate(pfsfn, NULL, NULL, &num) == plain_bytes + small_elf + wide_elf);
+    CHECK(num == 5);
+
+    config.keep_selfs = 1;
+    num = 0;
+    CHECK(unpfs_estimate(pfsfn, NULL, NULL, &num) == plain_bytes + small_size + small_elf + wide_size + wide_elf);
+    config.keep_selfs = 0;
+
+    free(small);
+    free(wide);
+    test_rmtree(dir);
+    free(dir);
+    return test_done("test_estimate");
+}
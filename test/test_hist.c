@@ -0,0 +1,59 @@
+#include "ps4.h"
+#include "main.h"
+#include "hist.h"
+#include "test.h"
+
+#include <pthread.h>
+
+// Many more short-lived recording threads than HIST_THREADS, a batch of
+// them at a time like the per-SELF prefetch threads: every record is
+// counted once and the maximum survives the tables changing hands.
+
+#define ROUNDS  40
+#define BATCH   12
+#define RECORDS 2000
+
+static void *recorder(void *arg)
+{
+    uint64_t base = (uint64_t)(uintptr_t)arg;
+    for (int i = 0; i < RECORDS; i++)
+        hist_record(HIST_WRITE, stats_now() - base - (i & 7));
+    hist_record(HIST_SELF_READ, stats_now());
+    hist_release();
+    return NULL;
+}
+
+static uint64_t json_field(const char *json, const char *name)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\": ", name);
+    const char *p = strstr(json, key);
+    return (p != NULL) ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+int main(void)
+{
+    char json[256];
+    pthread_t threads[BATCH];
+
+    hist_open();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < BATCH; i++)
+            pthread_create(&threads[i], NULL, recorder, (void *)(uintptr_t)(r * BATCH + i));
+        for (int i = 0; i < BATCH; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    hist_json(json, HIST_WRITE);
+    CHECK(json_field(json, "count") == (uint64_t)ROUNDS * BATCH * RECORDS);
+    CHECK(json_field(json, "max_us") >= ROUNDS * BATCH - 1 + 7);
+    CHECK(json_field(json, "p50_us") <= json_field(json, "max_us"));
+    hist_json(json, HIST_SELF_READ);
+    CHECK(json_field(json, "count") == ROUNDS * BATCH);
+    hist_json(json, HIST_PFS_READ);
+    CHECK(json_field(json, "count") == 0);
+    hist_close();
+
+    return test_done("test_hist");
+}
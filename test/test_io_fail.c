@@ -0,0 +1,113 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+// Output that can't be written fails the dump: a pack or a direct write
+// cut short by the file size limit, and a stream whose receiver hangs up,
+// make io_fini() report it. The same output that fits reports success.
+
+#define DUMP_SIZE  0x800000
+#define FILE_LIMIT 0x200000
+
+static uint8_t data[0x10000];
+
+// Writes the dump, DUMP_SIZE bytes in a single file. Returns io_fini().
+static int dump(int *write_failed)
+{
+    io_init("usb0", "CUSA00000", 2);
+    io_mkdir("usb0/CUSA00000");
+    io_file_t *f = io_open("usb0/CUSA00000/eboot.bin", DUMP_SIZE);
+    CHECK(f != NULL);
+    *write_failed = 0;
+    for (size_t done = 0; (f != NULL) && (done < DUMP_SIZE); done += sizeof(data))
+    {
+        if (io_write(f, data, sizeof(data)) != sizeof(data))
+            *write_failed = 1;
+    }
+    if (f != NULL)
+        io_close(f);
+    return io_fini();
+}
+
+static int dump_limited(int *write_failed)
+{
+    struct rlimit old, limit;
+    getrlimit(RLIMIT_FSIZE, &old);
+    limit = old;
+    limit.rlim_cur = FILE_LIMIT;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    int res = dump(write_failed);
+    setrlimit(RLIMIT_FSIZE, &old);
+    return res;
+}
+
+// Takes the connection and resets it right away.
+static void *hang_up(void *arg)
+{
+    int s = accept(*(int *)arg, NULL, NULL);
+    if (s >= 0)
+    {
+        struct linger lin = { 1, 0 };
+        setsockopt(s, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        close(s);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    int failed;
+
+    if (chdir(dir))
+        return 1;
+    mkdir("usb0", 0777);
+    signal(SIGXFSZ, SIG_IGN);
+    test_fill(data, sizeof(data), 1);
+
+    // Direct writes.
+    CHECK(dump(&failed) == 0);
+    CHECK(!failed);
+    CHECK(dump_limited(&failed) == -1);
+    CHECK(failed);
+
+    // A pack.
+    config.archive = 1;
+    CHECK(dump(&failed) == 0);
+    CHECK(!failed);
+    CHECK(dump_limited(&failed) == -1);
+    CHECK(failed);
+    config.archive = 0;
+
+    // A stream to a receiver that goes away.
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(l, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(listen(l, 1) == 0);
+    getsockname(l, (struct sockaddr *)&addr, &len);
+
+    pthread_t t;
+    pthread_create(&t, NULL, hang_up, &l);
+    strcpy(config.net_host, "127.0.0.1");
+    config.net_port = ntohs(addr.sin_port);
+    CHECK(dump(&failed) == -1);
+    CHECK(failed);
+    pthread_join(t, NULL);
+    close(l);
+    config.net_port = 0;
+
+    chdir("/");
+    test_rmtree(dir);
+    free(dir);
+    return test_done("test_io_fail");
+}
@@ -0,0 +1,157 @@
+#include "ps4.h"
+#include "dump.h"
+#include "test.h"
+
+// parse_phdr() against a plain reference on random phdr tables: segments
+// sorted by offset (larger first on equal offsets), segments contained in
+// an earlier one dropped unless they're version segments, and encrypted
+// segments padded to their alignment up to the next segment.
+
+#define PT_LOAD 1
+#define MAX_PHDRS 48
+
+static uint32_t seed = 12345;
+
+static uint32_t rnd(uint32_t n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+
+static int compare(const void *a, const void *b)
+{
+    const Elf64_Phdr *x = *(const Elf64_Phdr **)a;
+    const Elf64_Phdr *y = *(const Elf64_Phdr **)b;
+    if (x->p_offset != y->p_offset)
+        return (x->p_offset < y->p_offset) ? -1 : 1;
+    if (x->p_filesz != y->p_filesz)
+        return (x->p_filesz > y->p_filesz) ? -1 : 1;
+    return 0;
+}
+
+static void random_table(Elf64_Phdr *phdrs, int num)
+{
+    static const uint64_t aligns[] = { 1, 0x10, 0x1000, 0x4000 };
+    for (int i = 0; i < num; i++)
+    {
+        Elf64_Phdr *p = &phdrs[i];
+        memset(p, 0, sizeof(Elf64_Phdr));
+        p->p_type = PT_LOAD;
+        p->p_align = aligns[rnd(4)];
+        if ((i > 0) && (rnd(3) == 0))
+        {
+            // Inside an earlier segment, possibly at its very start.
+            Elf64_Phdr *outer = &phdrs[rnd(i)];
+            uint64_t skip = outer->p_filesz ? rnd(outer->p_filesz) & ~0xF : 0;
+            p->p_offset = outer->p_offset + skip;
+            p->p_filesz = (outer->p_filesz > skip) ? rnd(outer->p_filesz - skip) : 0;
+        }
+        else
+        {
+            p->p_offset = (uint64_t)rnd(0x10000) << 4;
+            p->p_filesz = (rnd(8) == 0) ? 0 : rnd(0x20000);
+        }
+        if (rnd(8) == 0)
+        {
+            p->p_type = SELF_PT_SCE_VERSION;
+            p->p_align = 1;
+        }
+        p->p_memsz = p->p_filesz;
+    }
+}
+
+static void check_table(Elf64_Phdr *phdrs, int num)
+{
+    const Elf64_Phdr *sorted[MAX_PHDRS];
+    const Elf64_Phdr *kept[MAX_PHDRS];
+    int nsorted = 0, nkept = 0;
+
+    for (int i = 0; i < num; i++)
+        if (phdrs[i].p_filesz > 0)
+            sorted[nsorted++] = &phdrs[i];
+    qsort(sorted, nsorted, sizeof(sorted[0]), compare);
+
+    uint64_t maxend = 0;
+    for (int i = 0; i < nsorted; i++)
+    {
+        uint64_t end = sorted[i]->p_offset + sorted[i]->p_filesz;
+        if ((i == 0) || (end > maxend) || (sorted[i]->p_type == SELF_PT_SCE_VERSION))
+            kept[nkept++] = sorted[i];
+        if (end > maxend)
+            maxend = end;
+    }
+
+    int count = -1;
+    SegmentBufInfo *infos = parse_phdr(phdrs, num, NULL, 0, 0x1000000, &count);
+    CHECK(count == nkept);
+    for (int i = 0; (i < count) && (i < nkept); i++)
+    {
+        const Elf64_Phdr *p = kept[i];
+        SegmentBufInfo *info = &infos[i];
+        CHECK(info->fileoff == p->p_offset);
+        CHECK(info->filesz == p->p_filesz);
+        CHECK(info->type == p->p_type);
+        // Ties between equal segments may go either way.
+        const Elf64_Phdr *source = &phdrs[info->index];
+        CHECK(compare(&source, &p) == 0);
+
+        uint64_t pad = 0;
+        if (p->p_type != SELF_PT_SCE_VERSION)
+        {
+            CHECK(info->enc);
+            uint64_t end = p->p_offset + ((p->p_filesz + p->p_align - 1) & ~(p->p_align - 1));
+            if ((i + 1 < nkept) && (end > kept[i + 1]->p_offset))
+                end = kept[i + 1]->p_offset;
+            if (end > p->p_offset + p->p_filesz)
+                pad = end - (p->p_offset + p->p_filesz);
+        }
+        else
+        {
+            CHECK(!info->enc);
+            CHECK(info->selfoff == 0x1000000 - p->p_filesz);
+        }
+        CHECK(info->pad == pad);
+    }
+    free(infos);
+}
+
+int main(void)
+{
+    Elf64_Phdr phdrs[MAX_PHDRS];
+
+    // The usual executable: text, data, a dynamic segment inside data, the
+    // version segment at the end.
+    memset(phdrs, 0, sizeof(phdrs));
+    phdrs[0] = (Elf64_Phdr){ PT_LOAD, 5, 0x4000, 0, 0, 0x9000, 0x9000, 0x4000 };
+    phdrs[1] = (Elf64_Phdr){ PT_LOAD, 6, 0x10000, 0, 0, 0x2345, 0x2345, 0x4000 };
+    phdrs[2] = (Elf64_Phdr){ 2, 6, 0x10100, 0, 0, 0x100, 0x100, 8 };
+    phdrs[3] = (Elf64_Phdr){ SELF_PT_SCE_VERSION, 4, 0x14000, 0, 0, 0x40, 0x40, 1 };
+    check_table(phdrs, 4);
+
+    int count;
+    SegmentBufInfo *infos = parse_phdr(phdrs, 4, NULL, 0, 0x20000, &count);
+    CHECK(count == 3);
+    CHECK(infos[0].pad == 0x3000);
+    CHECK(infos[1].pad == 0x14000 - 0x12345);
+    CHECK(infos[2].index == 3);
+    free(infos);
+
+    // Shuffled tables of every size.
+    for (int round = 0; round < 2000; round++)
+    {
+        int num = 1 + rnd(MAX_PHDRS);
+        random_table(phdrs, num);
+        for (int i = num - 1; i > 0; i--)
+        {
+            int j = rnd(i + 1);
+            Elf64_Phdr tmp = phdrs[i];
+            phdrs[i] = phdrs[j];
+            phdrs[j] = tmp;
+        }
+        check_table(phdrs, num);
+    }
+
+    return test_done("test_layout");
+}
@@ -0,0 +1,84 @@
+#include "ps4.h"
+#include "defines.h"
+#include "debug.h"
+#include "stats.h"
+#include "test.h"
+
+#include <arpa/inet.h>
+
+// Log lines longer than the format buffer, a deep PFS path in an error,
+// are cut to a slot and still end the line. The lines around them come
+// through whole. An idle sender is woken by the next line and by the
+// close: both come shortly after it went to sleep, well before its timeout.
+
+#define IDLE_USEC 20000
+#define WAKE_USEC 50000
+
+// Time until the next line arrives, which must be the given one.
+static uint64_t receive(int s, const char *expect)
+{
+    char got[64];
+    size_t size = 0;
+    ssize_t n;
+    uint64_t start = stats_now();
+    while ((size < strlen(expect)) && ((n = read(s, got + size, strlen(expect) - size)) > 0))
+        size += n;
+    CHECK((size == strlen(expect)) && !memcmp(got, expect, size));
+    return stats_now() - start;
+}
+
+int main(void)
+{
+    char path[1500];
+    memset(path, 0, sizeof(path));
+    strcpy(path, "/mnt/sandbox/pfsmnt/CUSA00000-app0");
+    while (strlen(path) + 12 < sizeof(path))
+        strcat(path, "/directory");
+
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(LOG_PORT);
+    inet_pton(AF_INET, LOG_IP, &addr.sin_addr);
+    CHECK(bind(l, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(listen(l, 1) == 0);
+
+    initDebugSocket();
+    int s = accept(l, NULL, NULL);
+    CHECK(s >= 0);
+    printfsocket("first\n");
+    receive(s, "first\n");
+    usleep(IDLE_USEC);
+    printfsocket("woken\n");
+    CHECK(receive(s, "woken\n") < WAKE_USEC);
+
+    printfsocket("before\n");
+    logsocket(LOG_ERROR, "open %s err : %s\n", path, "No such file or directory");
+    printfsocket("after %d\n", 1);
+    usleep(IDLE_USEC);
+    uint64_t closing = stats_now();
+    closeDebugSocket();
+    CHECK(stats_now() - closing < WAKE_USEC);
+
+    char got[4096];
+    size_t size = 0;
+    ssize_t n;
+    while ((size < sizeof(got) - 1) && ((n = read(s, got + size, sizeof(got) - 1 - size)) > 0))
+        size += n;
+    got[size] = '\0';
+    close(s);
+    close(l);
+
+    char *line = strchr(got, '\n');
+    CHECK(!strncmp(got, "before\n", 7));
+    const char *start = "open /mnt/sandbox/pfsmnt/CUSA00000-app0/directory";
+    CHECK((line != NULL) && !strncmp(line + 1, start, strlen(start)));
+    char *cut = (line != NULL) ? strchr(line + 1, '\n') : NULL;
+    CHECK((cut != NULL) && (cut - line < 512));
+    CHECK((cut != NULL) && !strcmp(cut + 1, "after 1\n"));
+
+    return test_done("test_log");
+}
@@ -0,0 +1,154 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "unpfs.h"
+#include "dump.h"
+#include "test.h"
+
+// unpfs_merge() of an app and a patch image: patch files override app files
+// of the same path whatever their sizes, everything else comes from the
+// image that has it, and each output file is written once.
+
+enum { A_ONLY, A_SMALLER, A_LARGER, A_EMPTY, A_PARAM, P_SMALLER, P_LARGER, P_EMPTY, P_NEW, P_DEEP, NUM_DATA };
+
+static const size_t sizes[NUM_DATA] = { 10000, 9000, 5000, 4096, 1200, 3000, 70000, 0, 2000, 8193 };
+static uint8_t *data[NUM_DATA];
+
+static const test_pfs_file_t app[] = {
+    { "a.bin", NULL, A_ONLY },
+    { "data/smaller.bin", NULL, A_SMALLER },
+    { "data/larger.bin", NULL, A_LARGER },
+    { "data/empty.bin", NULL, A_EMPTY },
+    { "sce_sys/param.sfo", NULL, A_PARAM },
+};
+
+static const test_pfs_file_t patch[] = {
+    { "data/smaller.bin", NULL, P_SMALLER },
+    { "data/larger.bin", NULL, P_LARGER },
+    { "data/empty.bin", NULL, P_EMPTY },
+    { "data/new.bin", NULL, P_NEW },
+    { "patch/deep/e.bin", NULL, P_DEEP },
+};
+
+#define NUM(a) (int)(sizeof(a) / sizeof(a[0]))
+
+// The tables carry the data index in the size field until here.
+static void resolve(test_pfs_file_t *out, const test_pfs_file_t *in, int num)
+{
+    for (int i = 0; i < num; i++)
+    {
+        out[i].name = in[i].name;
+        out[i].data = data[in[i].size];
+        out[i].size = sizes[in[i].size];
+    }
+}
+
+static uint64_t dump(char *dir, const char *name, char *appfn, char *patchfn)
+{
+    char tidpath[128];
+    stats_t st;
+
+    snprintf(tidpath, sizeof(tidpath), "%s/%s", dir, name);
+    stats_start(&st, name);
+    io_init(dir, (char *)name, 1);
+    CHECK(unpfs_merge(appfn, patchfn, tidpath, NULL, &st) == 0);
+    io_fini();
+    return st.written;
+}
+
+static void check_file(const char *dir, const char *name, int index)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    CHECK(test_file_equals(path, data[index], sizes[index]));
+}
+
+// Encrypted executables are left to the decrypt stage, except the ones it
+// skips by name with skip_assets.
+static void check_selfs(char *dir)
+{
+    char pfsfn[128], out[128], path[256];
+    uint8_t self[0x100];
+    memset(self, 0, sizeof(self));
+    struct self_header_t *hdr = (struct self_header_t *)self;
+    hdr->magic = SELF_MAGIC;
+    hdr->num_entries = 1;
+    *(uint32_t *)(self + sizeof(struct self_header_t) + sizeof(struct self_entry_t)) = ELF_MAGIC;
+
+    test_pfs_file_t files[] = {
+        { "eboot.bin", self, sizeof(self) },
+        { "data/texture.png", self, sizeof(self) },
+    };
+    snprintf(pfsfn, sizeof(pfsfn), "%s/selfs.dat", dir);
+    CHECK(test_pfs_build(pfsfn, files, NUM(files)) > 0);
+
+    config.keep_selfs = 0;
+    config.skip_assets = 1;
+    dump(dir, "SELFS", pfsfn, NULL);
+    snprintf(out, sizeof(out), "%s/SELFS", dir);
+    snprintf(path, sizeof(path), "%s/eboot.bin", out);
+    CHECK(!test_exists(path));
+    snprintf(path, sizeof(path), "%s/data/texture.png", out);
+    CHECK(test_file_equals(path, self, sizeof(self)));
+
+    config.skip_assets = 0;
+    dump(dir, "ALLSELFS", pfsfn, NULL);
+    snprintf(path, sizeof(path), "%s/ALLSELFS/data/texture.png", dir);
+    CHECK(!test_exists(path));
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char appfn[128], patchfn[128], out[128];
+    test_pfs_file_t files[8];
+    uint64_t app_size = 0, patch_size = 0, union_size = 0;
+
+    for (int i = 0; i < NUM_DATA; i++)
+    {
+        data[i] = malloc(sizes[i] + 1);
+        test_fill(data[i], sizes[i], i + 1);
+    }
+
+    snprintf(appfn, sizeof(appfn), "%s/app.dat", dir);
+    resolve(files, app, NUM(app));
+    CHECK(test_pfs_build(appfn, files, NUM(app)) > 0);
+    for (int i = 0; i < NUM(app); i++)
+        app_size += files[i].size;
+
+    snprintf(patchfn, sizeof(patchfn), "%s/patch.dat", dir);
+    resolve(files, patch, NUM(patch));
+    CHECK(test_pfs_build(patchfn, files, NUM(patch)) > 0);
+    for (int i = 0; i < NUM(patch); i++)
+        patch_size += files[i].size;
+
+    union_size = sizes[A_ONLY] + sizes[A_PARAM] + patch_size;
+
+    uint64_t merged = dump(dir, "MERGED", appfn, patchfn);
+    snprintf(out, sizeof(out), "%s/MERGED", dir);
+    check_file(out, "a.bin", A_ONLY);
+    check_file(out, "sce_sys/param.sfo", A_PARAM);
+    check_file(out, "data/smaller.bin", P_SMALLER);
+    check_file(out, "data/larger.bin", P_LARGER);
+    check_file(out, "data/empty.bin", P_EMPTY);
+    check_file(out, "data/new.bin", P_NEW);
+    check_file(out, "patch/deep/e.bin", P_DEEP);
+
+    // The old flow: the app image, then the patch image over it.
+    uint64_t sequential = dump(dir, "SEQUENTIAL", appfn, NULL);
+    snprintf(out, sizeof(out), "%s/SEQUENTIAL", dir);
+    sequential += dump(dir, "SEQUENTIAL", patchfn, NULL);
+    check_file(out, "data/smaller.bin", P_SMALLER);
+
+    printf("app %llu + patch %llu bytes: merged wrote %llu, app then patch %llu\n",
+           (unsigned long long)app_size, (unsigned long long)patch_size,
+           (unsigned long long)merged, (unsigned long long)sequential);
+    CHECK(merged == union_size);
+    CHECK(sequential == app_size + patch_size);
+    CHECK(merged < sequential);
+
+    check_selfs(dir);
+
+    test_rmtree(dir);
+    return test_done("test_merge");
+}
@@ -0,0 +1,43 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "test.h"
+
+// io_mkdir() issues a mkdir once per directory and says when it did, so
+// the phases count only the syscalls that happened. Directories of a pack
+// never reach the disk.
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    uint32_t calls, skipped;
+
+    if (chdir(dir))
+        return 1;
+    mkdir("usb0", 0777);
+
+    io_init("usb0", "CUSA00000", 1);
+    CHECK(io_mkdir("usb0/CUSA00000") == 1);
+    CHECK(io_mkdir("usb0/CUSA00000/sce_sys") == 1);
+    CHECK(io_mkdir("usb0/CUSA00000") == 0);
+    CHECK(io_mkdir("usb0/CUSA00000/sce_sys") == 0);
+    CHECK(test_exists("usb0/CUSA00000/sce_sys"));
+    io_mkdir_stats(&calls, &skipped);
+    CHECK((calls == 2) && (skipped == 2));
+    CHECK(io_fini() == 0);
+
+    config.archive = 1;
+    io_init("usb0", "CUSA00001", 1);
+    CHECK(io_mkdir("usb0/CUSA00001") == 0);
+    CHECK(io_mkdir("usb0/CUSA00001/sce_sys") == 0);
+    CHECK(!test_exists("usb0/CUSA00001"));
+    io_mkdir_stats(&calls, &skipped);
+    CHECK(calls == 0);
+    CHECK(io_fini() == 0);
+    config.archive = 0;
+
+    chdir("/");
+    test_rmtree(dir);
+    free(dir);
+    return test_done("test_mkdir");
+}
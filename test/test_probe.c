@@ -0,0 +1,209 @@
+#include "types.h"
+#include "libc.h"
+#include "probe.h"
+#include "test.h"
+
+// usb_probe_measure() and usb_probe_pick() against simulated disks. Every
+// call costs virtual time: a write or read its latency plus its size at
+// the disk's bandwidth, a new file its creation time. Concurrent writers
+// run on clocks of their own and either share the bandwidth or each get
+// all of it. Only probe.c is linked, none of the payload.
+
+typedef struct {
+    uint32_t latency;
+    uint32_t bandwidth;
+    uint32_t create;
+    int independent;
+    int corrupt;
+    int fail;
+} disk_t;
+
+#define MAX_FILES 48
+#define LANES 4
+
+typedef struct {
+    char path[80];
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+    int used;
+} file_t;
+
+static const disk_t *disk;
+static file_t files[MAX_FILES];
+static uint64_t clocks[LANES];
+static int lane, active = 1;
+
+static void spend(uint64_t bytes, uint32_t latency)
+{
+    uint32_t share = disk->independent ? 1 : active;
+    clocks[lane] += latency + bytes * 1000000 * share / disk->bandwidth;
+}
+
+static int sim_open(const char *path, int write)
+{
+    int free = -1;
+    for (int i = 0; i < MAX_FILES; i++)
+    {
+        if (files[i].used && !strcmp(files[i].path, path))
+        {
+            if (write)
+                files[i].size = 0;
+            files[i].pos = 0;
+            return i;
+        }
+        if (!files[i].used && (free == -1))
+            free = i;
+    }
+    if (!write || (free == -1))
+        return -1;
+    clocks[lane] += disk->create;
+    file_t *f = &files[free];
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    f->data = NULL;
+    f->size = f->pos = 0;
+    f->used = 1;
+    return free;
+}
+
+static ssize_t sim_read(int fd, void *buf, size_t size)
+{
+    file_t *f = &files[fd];
+    if (size > f->size - f->pos)
+        size = f->size - f->pos;
+    memcpy(buf, f->data + f->pos, size);
+    if (disk->corrupt && size)
+        ((uint8_t *)buf)[size / 2] ^= 0x10;
+    f->pos += size;
+    spend(size, disk->latency);
+    return size;
+}
+
+static ssize_t sim_write(int fd, const void *buf, size_t size)
+{
+    file_t *f = &files[fd];
+    if (disk->fail)
+        return -1;
+    f->data = realloc(f->data, f->pos + size);
+    memcpy(f->data + f->pos, buf, size);
+    f->pos += size;
+    if (f->pos > f->size)
+        f->size = f->pos;
+    spend(size, disk->latency);
+    return size;
+}
+
+static void sim_sync(int fd)
+{
+}
+
+static void sim_close(int fd)
+{
+}
+
+static void sim_unlink(const char *path)
+{
+    for (int i = 0; i < MAX_FILES; i++)
+    {
+        if (files[i].used && !strcmp(files[i].path, path))
+        {
+            free(files[i].data);
+            files[i].used = 0;
+        }
+    }
+}
+
+static uint64_t sim_now(void)
+{
+    return clocks[lane];
+}
+
+// One after the other, each from the same start on a clock of its own.
+static void sim_parallel(void *(*fn)(void *), void **args, int num)
+{
+    uint64_t start = clocks[0], end = start;
+    active = num;
+    for (int i = 0; i < num; i++)
+    {
+        lane = i;
+        clocks[i] = start;
+        fn(args[i]);
+        if (clocks[i] > end)
+            end = clocks[i];
+    }
+    lane = 0;
+    active = 1;
+    clocks[0] = end;
+}
+
+static const probe_io_t sim_io = {
+    sim_open, sim_read, sim_write, sim_sync, sim_close, sim_unlink, sim_now, sim_parallel,
+};
+
+static int measure(const disk_t *d, probe_t *p)
+{
+    disk = d;
+    clocks[0] = 0;
+    int res = usb_probe_measure("usb0", &sim_io, p);
+    for (int i = 0; i < MAX_FILES; i++)
+        CHECK(!files[i].used);
+    return res;
+}
+
+#define MIB (1024 * 1024)
+
+int main(void)
+{
+    probe_t p;
+    probe_profile_t prof;
+
+    // Latency bound: the largest writes win, two writers hide most of the
+    // latency and four don't gain another 5%.
+    disk_t fast = { 2000, 100 * MIB, 0, 0, 0, 0 };
+    CHECK(measure(&fast, &p) == 0);
+    CHECK(p.verified);
+    CHECK((p.chunk_rate[0] < p.chunk_rate[1]) && (p.chunk_rate[1] < p.chunk_rate[2]));
+    CHECK((p.depth_rate[0] < p.depth_rate[1]) && (p.depth_rate[1] < p.depth_rate[2]));
+    usb_probe_pick(&p, 2, &prof);
+    CHECK(prof.decrypt_window == 1024);
+    CHECK(prof.io_writers == 2);
+    CHECK(!prof.archive && !prof.compress);
+
+    // Bandwidth bound and slow: every setting is as good, the largest
+    // writes and a single writer are picked, and compression pays off.
+    disk_t slow = { 0, 8 * MIB, 0, 0, 0, 0 };
+    CHECK(measure(&slow, &p) == 0);
+    CHECK((p.read_rate >= 8192 * 19 / 20) && (p.read_rate <= 8192));
+    usb_probe_pick(&p, 2, &prof);
+    CHECK(prof.decrypt_window == 1024);
+    CHECK(prof.io_writers == 1);
+    CHECK(prof.compress && !prof.archive);
+    usb_probe_pick(&p, 1, &prof);
+    CHECK(!prof.compress && !prof.archive);
+
+    // Writers that don't share the bandwidth: four of them, and fast
+    // enough together not to compress.
+    disk_t lanes = { 0, 8 * MIB, 0, 1, 0, 0 };
+    CHECK(measure(&lanes, &p) == 0);
+    usb_probe_pick(&p, 2, &prof);
+    CHECK(prof.io_writers == 4);
+    CHECK(!prof.compress && !prof.archive);
+
+    // Fast writes, slow to create files: a pack.
+    disk_t files_slow = { 0, 100 * MIB, 20000, 0, 0, 0 };
+    CHECK(measure(&files_slow, &p) == 0);
+    CHECK(p.file_rate < PROBE_SLOW_FILES);
+    usb_probe_pick(&p, 2, &prof);
+    CHECK(prof.archive && !prof.compress);
+
+    // A disk that gives back other data than written.
+    disk_t corrupt = { 0, 100 * MIB, 0, 0, 1, 0 };
+    CHECK(measure(&corrupt, &p) == 0);
+    CHECK(!p.verified);
+
+    // And one that can't be written.
+    disk_t broken = { 0, 100 * MIB, 0, 0, 0, 1 };
+    CHECK(measure(&broken, &p) == -1);
+
+    return test_done("test_probe");
+}
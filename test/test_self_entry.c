@@ -0,0 +1,119 @@
+#include "ps4.h"
+#include "main.h"
+#include "dump.h"
+#include "io.h"
+#include "test.h"
+
+// The SELF entry lookup and the header size limit on synthetic headers.
+
+#define PT_LOAD 1
+
+static const test_self_segment_t segs[] = {
+    { { PT_LOAD, 5, 0x4000, 0, 0, 0x3000, 0x3000, 0x4000 }, SELF_ENTRY_ENCRYPTED, 0 },
+    { { PT_LOAD, 6, 0x8000, 0, 0, 0x1000, 0x1000, 0x4000 }, SELF_ENTRY_SIGNED, 0 },
+    { { PT_LOAD, 6, 0xC000, 0, 0, 0x2000, 0x2000, 0x4000 }, SELF_ENTRY_COMPRESSED, 0x800 },
+    { { PT_LOAD, 6, 0x10000, 0, 0, 0x2000, 0x2000, 0x4000 }, SELF_ENTRY_SIGNED, 0x1000 },
+    { { PT_LOAD, 4, 0x14000, 0, 0, 0x1000, 0x1000, 0x4000 }, 0, 0 },
+};
+
+#define NUM_SEGS (int)(sizeof(segs) / sizeof(segs[0]))
+
+static void check_entries(void)
+{
+    size_t size;
+    uint8_t *self = test_self_image(segs, NUM_SEGS, &size);
+    struct self_header_t *hdr = (struct self_header_t *)self;
+    struct self_entry_t *entries = (struct self_entry_t *)(self + sizeof(struct self_header_t));
+    CHECK(hdr->num_entries == 8);
+
+    // The hash entry of a segment has the id of the next one, only the
+    // blocked data entry counts.
+    for (int i = 0; i < 4; i++)
+    {
+        struct self_entry_t *e = find_self_entry(entries, hdr->num_entries, i);
+        CHECK(e == &entries[i * 2 + 1]);
+    }
+    CHECK(find_self_entry(entries, hdr->num_entries, 4) == NULL);
+    CHECK(find_self_entry(entries, hdr->num_entries, 5) == NULL);
+    CHECK(find_self_entry(entries, 0, 0) == NULL);
+
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)((uint8_t *)(entries + hdr->num_entries) + sizeof(Elf64_Ehdr));
+    int count;
+    SegmentBufInfo *infos = parse_phdr(phdrs, NUM_SEGS, entries, hdr->num_entries, size, &count);
+    CHECK(count == NUM_SEGS);
+
+    // Encrypted.
+    CHECK(infos[0].enc && !infos[0].comp);
+    // Stored as is, read from the entry's range.
+    CHECK(!infos[1].enc && (infos[1].selfoff == entries[3].offset) && (infos[1].selfsz == 0x1000));
+    // Compressed, decrypted whatever the other flags.
+    CHECK(infos[2].enc && infos[2].comp && (infos[2].selfsz == 0x800));
+    // Stored but shorter than the segment, has to go through the mapping.
+    CHECK(infos[3].enc && !infos[3].comp);
+    // No entry at all, padded to its alignment as the last segment.
+    CHECK(infos[4].enc && (infos[4].selfsz == 0x1000));
+    free(infos);
+
+    CHECK(self_output_size(self, SELF_HEADER_MAX, size) == 0x18000);
+    CHECK(self_output_size(self, sizeof(struct self_header_t) + 4 * sizeof(struct self_entry_t), size) == 0);
+    free(self);
+}
+
+// A SELF with num phdrs and no entries, the last phdr is the only segment.
+static test_self_segment_t *wide_self(int num)
+{
+    test_self_segment_t *wide = calloc(num, sizeof(test_self_segment_t));
+    wide[num - 1].phdr = (Elf64_Phdr){ PT_LOAD, 5, 0x4000, 0, 0, 0x1000, 0x1000, 0x4000 };
+    return wide;
+}
+
+// The header, entries, ELF header and phdrs have to fit SELF_HEADER_MAX.
+static void check_header_limit(const char *dir)
+{
+    char selffn[128], out[128];
+    int fits = (SELF_HEADER_MAX - sizeof(struct self_header_t) - sizeof(Elf64_Ehdr)) / sizeof(Elf64_Phdr);
+
+    for (int num = fits; num <= fits + 1; num++)
+    {
+        test_self_segment_t *wide = wide_self(num);
+        CHECK((test_self_header(wide, num) <= SELF_HEADER_MAX) == (num == fits));
+
+        size_t size;
+        uint8_t *self = test_self_image(wide, num, &size);
+        snprintf(selffn, sizeof(selffn), "%s/wide%d.bin", dir, num);
+        snprintf(out, sizeof(out), "%s/wide%d.elf", dir, num);
+        CHECK(test_write_file(selffn, self, size) == 0);
+
+        int res = decrypt_and_dump_self(selffn, out);
+        uint64_t elfsz = self_output_size(self, (size < SELF_HEADER_MAX) ? size : SELF_HEADER_MAX, size);
+        if (num == fits)
+        {
+            CHECK(res == 0);
+            CHECK(elfsz == 0x8000);
+            CHECK(test_exists(out));
+        }
+        else
+        {
+            CHECK(res == -1);
+            CHECK(elfsz == 0);
+            CHECK(!test_exists(out));
+        }
+        free(self);
+        free(wide);
+    }
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    io_init(dir, "CUSA00000", 1);
+    config.decrypt_window = 64;
+    config.decrypt_queue = 2;
+
+    check_entries();
+    check_header_limit(dir);
+
+    io_fini();
+    test_rmtree(dir);
+    return test_done("test_self_entry");
+}
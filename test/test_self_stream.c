@@ -0,0 +1,92 @@
+#include "ps4.h"
+#include "main.h"
+#include "dump.h"
+#include "io.h"
+#include "test.h"
+
+// decrypt_self() streams the ELF out in one forward pass of windows: the
+// ELF header and phdrs, every segment at its offset, encrypted ones padded
+// up to their alignment but never over the next segment, holes between
+// segments left empty, contained segments not written again and the
+// version segment taken from the end of the SELF.
+
+#define PT_LOAD    1
+#define PT_DYNAMIC 2
+
+static const test_self_segment_t segs[] = {
+    { { PT_LOAD, 5, 0x4000, 0, 0, 0x9000, 0x9000, 0x4000 }, SELF_ENTRY_ENCRYPTED, 0 },
+    { { PT_LOAD, 6, 0x10000, 0, 0, 0x2345, 0x2345, 0x4000 }, SELF_ENTRY_SIGNED, 0 },
+    { { PT_DYNAMIC, 6, 0x10100, 0, 0, 0x100, 0x100, 8 }, 0, 0 },
+    { { PT_LOAD, 5, 0x20000, 0, 0, 0x41800, 0x41800, 0x4000 }, SELF_ENTRY_ENCRYPTED | SELF_ENTRY_COMPRESSED, 0x30000 },
+    { { SELF_PT_SCE_VERSION, 4, 0x64000, 0, 0, 0x40, 0x40, 1 }, 0, 0 },
+};
+
+#define NUM_SEGS (int)(sizeof(segs) / sizeof(segs[0]))
+#define ELF_SIZE 0x64040
+
+// The ELF decrypt_self() should write, with segment fail left out.
+static uint8_t *expected(const uint8_t *self, int fail)
+{
+    uint8_t *elf = calloc(1, ELF_SIZE);
+    size_t header = test_self_header(segs, NUM_SEGS);
+    size_t elfhdr = sizeof(Elf64_Ehdr) + NUM_SEGS * sizeof(Elf64_Phdr);
+    memcpy(elf, self + header - elfhdr, elfhdr);
+
+    // Segment 2 lies in segment 1, the padding (zeros) needs no writing.
+    int written[] = { 0, 1, 3, 4 };
+    for (int j = 0; j < 4; j++)
+    {
+        int i = written[j];
+        if (i == fail)
+            continue;
+        for (uint64_t k = 0; k < segs[i].phdr.p_filesz; k++)
+            elf[segs[i].phdr.p_offset + k] = test_self_byte(i, k);
+    }
+    return elf;
+}
+
+static void check_dump(const char *dir, const char *selffn, const uint8_t *self, size_t selfsz, int window, int queue, int fail)
+{
+    char out[256];
+    snprintf(out, sizeof(out), "%s/out-%d-%d-%d.elf", dir, window, queue, fail);
+
+    config.decrypt_window = window;
+    config.decrypt_queue = queue;
+    host_fail_segment = fail;
+    int res = decrypt_and_dump_self((char *)selffn, out);
+    host_fail_segment = -1;
+    CHECK(res == ((fail >= 0) ? 1 : 0));
+
+    uint8_t *elf = expected(self, fail);
+    CHECK(test_file_equals(out, elf, ELF_SIZE));
+    free(elf);
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char selffn[128];
+    size_t selfsz;
+
+    io_init(dir, "CUSA00000", 1);
+
+    snprintf(selffn, sizeof(selffn), "%s/eboot.bin", dir);
+    uint8_t *self = test_self_image(segs, NUM_SEGS, &selfsz);
+    CHECK(test_write_file(selffn, self, selfsz) == 0);
+
+    CHECK(self_output_size(self, SELF_HEADER_MAX, selfsz) == ELF_SIZE);
+
+    // Windows smaller than the segments and larger than all of them.
+    check_dump(dir, selffn, self, selfsz, 16, 2, -1);
+    check_dump(dir, selffn, self, selfsz, 16, 4, -1);
+    check_dump(dir, selffn, self, selfsz, 1024, 2, -1);
+
+    // A segment that can't be decrypted is left out, the rest is written.
+    check_dump(dir, selffn, self, selfsz, 16, 2, 3);
+    check_dump(dir, selffn, self, selfsz, 1024, 3, 0);
+
+    io_fini();
+    free(self);
+    test_rmtree(dir);
+    return test_done("test_self_stream");
+}
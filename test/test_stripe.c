@@ -0,0 +1,191 @@
+#include "ps4.h"
+#include "main.h"
+#include "io.h"
+#include "test.h"
+
+// Striped output over three stand-in USB disks (usb0..usb2 in a temporary
+// directory): every file lands whole on one disk, the disks fill evenly,
+// the placement map lists every file, and tool/stripe_merge puts the tree
+// back together on the first disk.
+
+#define NUM_FILES 24
+
+static size_t file_size(int i)
+{
+    return (i % 5 == 0) ? 0x30000 + i * 0x1000 : 0x800 + i * 0x321;
+}
+
+static void file_name(int i, char *rel, size_t size)
+{
+    snprintf(rel, size, "CUSA00000/%s/file%02d.bin", (i & 1) ? "data/sub" : "data", i);
+}
+
+static void write_file(const char *path, const uint8_t *data, size_t size)
+{
+    io_file_t *f = io_open(path, size);
+    CHECK(f != NULL);
+    if (f == NULL)
+        return;
+    io_write(f, data, size);
+    io_close(f);
+}
+
+// A patch file written over the app's: the second write goes to the disk
+// of the first, and the merge keeps the last one. Run in a directory of
+// its own with two disks.
+static void check_rewrite(void)
+{
+    uint8_t big[0x20000], app[0x100], patch[0x180];
+    test_fill(big, sizeof(big), 10);
+    test_fill(app, sizeof(app), 11);
+    test_fill(patch, sizeof(patch), 12);
+
+    mkdir("two", 0777);
+    if (chdir("two"))
+        return;
+    mkdir("usb0", 0777);
+    mkdir("usb1", 0777);
+
+    // Left to the least used disk, the patch's param.sfo would go to usb0.
+    io_init("usb0", "CUSA00000", 1);
+    CHECK(io_devices() == 2);
+    io_mkdir("usb0/CUSA00000");
+    write_file("usb0/CUSA00000/big0.bin", big, sizeof(big) / 2);
+    write_file("usb0/CUSA00000/param.sfo", app, sizeof(app));
+    write_file("usb0/CUSA00000/big1.bin", big, sizeof(big));
+    write_file("usb0/CUSA00000/param.sfo", patch, sizeof(patch));
+    io_fini();
+
+    CHECK(!test_exists("usb0/CUSA00000/param.sfo"));
+    CHECK(test_file_equals("usb1/CUSA00000/param.sfo", patch, sizeof(patch)));
+    CHECK(system(STRIPE_MERGE " usb0/CUSA00000.stripe > /dev/null") == 0);
+    CHECK(test_file_equals("usb0/CUSA00000/param.sfo", patch, sizeof(patch)));
+
+    // Maps of earlier dumps can have the copies on different disks, the
+    // last line wins whatever the disk.
+    const char *map = "D 0 usb0\nD 1 usb1\nF 1 256 CUSA00001/param.sfo\nF 0 384 CUSA00001/param.sfo\n";
+    mkdir("usb0/CUSA00001", 0777);
+    mkdir("usb1/CUSA00001", 0777);
+    CHECK(test_write_file("usb1/CUSA00001/param.sfo", app, sizeof(app)) == 0);
+    CHECK(test_write_file("usb0/CUSA00001/param.sfo", patch, sizeof(patch)) == 0);
+    CHECK(test_write_file("usb0/CUSA00001.stripe", map, strlen(map)) == 0);
+    CHECK(system(STRIPE_MERGE " usb0/CUSA00001.stripe > /dev/null") == 0);
+    CHECK(test_file_equals("usb0/CUSA00001/param.sfo", patch, sizeof(patch)));
+
+    if (chdir(".."))
+        return;
+}
+
+int main(void)
+{
+    char *dir = test_tmpdir();
+    char rel[128], path[256];
+    uint8_t *data[NUM_FILES];
+    uint64_t bytes[3] = { 0 };
+    size_t largest = 0;
+
+    if (chdir(dir))
+        return 1;
+    mkdir("usb0", 0777);
+    mkdir("usb1", 0777);
+    mkdir("usb2", 0777);
+
+    config.stripe = 1;
+    io_init("usb0", "CUSA00000", 2);
+    CHECK(io_devices() == 3);
+    CHECK(!io_direct());
+
+    io_mkdir("usb0/CUSA00000");
+    io_mkdir("usb0/CUSA00000/data");
+    io_mkdir("usb0/CUSA00000/data/sub");
+    for (int i = 0; i < NUM_FILES; i++)
+    {
+        size_t size = file_size(i);
+        if (size > largest)
+            largest = size;
+        data[i] = malloc(size);
+        test_fill(data[i], size, i + 1);
+        file_name(i, rel, sizeof(rel));
+        snprintf(path, sizeof(path), "usb0/%s", rel);
+
+        // Half the files are written in two parts, with a wrong size hint.
+        io_file_t *f = io_open(path, (i & 2) ? size / 2 : size);
+        CHECK(f != NULL);
+        if (f == NULL)
+            continue;
+        io_write(f, data[i], size / 3);
+        io_write(f, data[i] + size / 3, size - size / 3);
+        io_close(f);
+    }
+    io_fini();
+
+    // Whole files, on exactly one disk each.
+    for (int i = 0; i < NUM_FILES; i++)
+    {
+        int found = 0;
+        file_name(i, rel, sizeof(rel));
+        for (int d = 0; d < 3; d++)
+        {
+            snprintf(path, sizeof(path), "usb%d/%s", d, rel);
+            if (!test_exists(path))
+                continue;
+            found++;
+            bytes[d] += file_size(i);
+            CHECK(test_file_equals(path, data[i], file_size(i)));
+        }
+        CHECK(found == 1);
+    }
+    for (int d = 0; d < 3; d++)
+    {
+        uint64_t lo = bytes[d], hi = bytes[d];
+        for (int e = 0; e < 3; e++)
+        {
+            if (bytes[e] < lo) lo = bytes[e];
+            if (bytes[e] > hi) hi = bytes[e];
+        }
+        CHECK(hi - lo <= 2 * largest);
+        CHECK(bytes[d] > 0);
+    }
+
+    // The map: the disks, then one line per file with its disk and size.
+    size_t mapsize;
+    char *map = test_read_file("usb0/CUSA00000.stripe", &mapsize);
+    CHECK(map != NULL);
+    if (map != NULL)
+    {
+        map[mapsize] = '\0';
+        CHECK(strstr(map, "D 0 usb0\n") && strstr(map, "D 1 usb1\n") && strstr(map, "D 2 usb2\n"));
+        for (int i = 0; i < NUM_FILES; i++)
+        {
+            char line[160];
+            int dev = -1;
+            file_name(i, rel, sizeof(rel));
+            for (int d = 0; d < 3; d++)
+            {
+                snprintf(path, sizeof(path), "usb%d/%s", d, rel);
+                if (test_exists(path))
+                    dev = d;
+            }
+            snprintf(line, sizeof(line), "F %d %zu %s\n", dev, file_size(i), rel);
+            CHECK(strstr(map, line) != NULL);
+        }
+        free(map);
+    }
+
+    // Merged back onto the first disk.
+    CHECK(system(STRIPE_MERGE " usb0/CUSA00000.stripe > /dev/null") == 0);
+    for (int i = 0; i < NUM_FILES; i++)
+    {
+        file_name(i, rel, sizeof(rel));
+        snprintf(path, sizeof(path), "usb0/%s", rel);
+        CHECK(test_file_equals(path, data[i], file_size(i)));
+        free(data[i]);
+    }
+
+    check_rewrite();
+
+    if (chdir("/"))
+        return 1;
+    test_rmtree(dir);
+    return test_done("test_stripe");
+}
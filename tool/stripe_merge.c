@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Copies the files of a dump spread over several USB disks back into the
+// tree on the first disk, following the TITLE_ID.stripe placement map.
+//
+// usage: stripe_merge TITLE_ID.stripe [root0 root1 ...]
+//
+// The roots default to the mount points recorded in the map, pass them when
+// the disks are mounted elsewhere on the PC.
+
+#define MAX_DEVICES 8
+
+static void mkdirs(char *path)
+{
+  for (char *p = path + 1; *p; p++)
+  {
+    if (*p == '/')
+    {
+      *p = 0;
+      mkdir(path, 0777);
+      *p = '/';
+    }
+  }
+}
+
+static int copy(const char *src, char *dst, uint64_t size)
+{
+  static char buf[1 << 20];
+  FILE *in = fopen(src, "rb");
+  if (!in)
+    return -1;
+  mkdirs(dst);
+  FILE *out = fopen(dst, "wb");
+  if (!out)
+  {
+    fclose(in);
+    return -1;
+  }
+  size_t n;
+  uint64_t total = 0;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+  {
+    fwrite(buf, 1, n, out);
+    total += n;
+  }
+  fclose(in);
+  fclose(out);
+  if (total != size)
+    fprintf(stderr, "%s: %llu bytes, map says %llu\n", src, (unsigned long long)total, (unsigned long long)size);
+  return 0;
+}
+
+// A file written more than once in a dump has a line per write, the last
+// one says where it is now.
+typedef struct
+{
+  char *rel;
+  int dev;
+  int line;
+  uint64_t size;
+} entry_t;
+
+static int by_path(const void *a, const void *b)
+{
+  const entry_t *x = a, *y = b;
+  int c = strcmp(x->rel, y->rel);
+  return c ? c : x->line - y->line;
+}
+
+int main(int argc, char** argv)
+{
+  char *roots[MAX_DEVICES] = { 0 };
+  char line[4096];
+  int files = 0, errors = 0;
+  entry_t *entries = NULL;
+  int count = 0, capacity = 0;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s TITLE_ID.stripe [root0 root1 ...]\n", argv[0]);
+    return 1;
+  }
+  FILE *map = fopen(argv[1], "r");
+  if (!map)
+  {
+    fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  for (int i = 2; (i < argc) && (i - 2 < MAX_DEVICES); i++)
+    roots[i - 2] = argv[i];
+
+  while (fgets(line, sizeof(line), map))
+  {
+    line[strcspn(line, "\n")] = 0;
+    int dev, pos;
+    unsigned long long size;
+    if ((line[0] == 'D') && (sscanf(line, "D %d %n", &dev, &pos) == 1))
+    {
+      if ((dev >= 0) && (dev < MAX_DEVICES) && !roots[dev])
+        roots[dev] = strdup(line + pos);
+    }
+    else
+    if ((line[0] == 'F') && (sscanf(line, "F %d %llu %n", &dev, &size, &pos) == 2))
+    {
+      if (count == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 1024;
+        entries = realloc(entries, sizeof(entry_t) * capacity);
+      }
+      entries[count].rel = strdup(line + pos);
+      entries[count].dev = dev;
+      entries[count].line = count;
+      entries[count].size = size;
+      count++;
+    }
+  }
+  fclose(map);
+
+  qsort(entries, count, sizeof(entry_t), by_path);
+  for (int i = 0; i < count; i++)
+  {
+    entry_t *e = &entries[i];
+    if ((i + 1 < count) && !strcmp(e->rel, entries[i + 1].rel))
+      continue;
+    if ((e->dev < 0) || (e->dev >= MAX_DEVICES) || !roots[e->dev] || !roots[0])
+    {
+      fprintf(stderr, "no root for device %d: %s\n", e->dev, e->rel);
+      errors++;
+      continue;
+    }
+    if (e->dev == 0)
+      continue;
+    char src[4096 + 256], dst[4096 + 256];
+    snprintf(src, sizeof(src), "%s/%s", roots[e->dev], e->rel);
+    snprintf(dst, sizeof(dst), "%s/%s", roots[0], e->rel);
+    if (copy(src, dst, e->size))
+    {
+      fprintf(stderr, "%s: %s\n", src, strerror(errno));
+      errors++;
+    }
+    else
+      files++;
+  }
+  for (int i = 0; i < count; i++)
+    free(entries[i].rel);
+  free(entries);
+
+  printf("%d files merged, %d errors\n", files, errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Extracts a TITLE_ID.pack written by the dumper with archive=1 or
+// compress=1, or receives the same stream over TCP when the dumper is set
+// up with net_host/net_port.
+//
+// usage: unpack TITLE_ID.pack [destination]
+//        unpack -l PORT [destination]
+
+#define PACK_MAGIC 0x4B415044 // DPAK
+#define PACK_DIR   1
+
+#define CODEC_STORED 0
+#define CODEC_LZ4    1
+#define CODEC_ENTRY  2
+#define CODEC_END    3
+
+struct pack_header_t
+{
+  uint32_t magic;
+  uint32_t count;
+  uint64_t index;
+};
+
+struct pack_record_t
+{
+  uint32_t id;
+  uint32_t len;
+  uint64_t offset;
+  uint32_t raw;
+  uint32_t codec;
+};
+
+struct pack_entry_t
+{
+  uint64_t size;
+  uint32_t type;
+  uint32_t namelen;
+};
+
+static void mkdirs(char *path)
+{
+  for (char *p = path + 1; *p; p++)
+  {
+    if (*p == '/')
+    {
+      *p = 0;
+      mkdir(path, 0777);
+      *p = '/';
+    }
+  }
+}
+
+// Decodes one LZ4 block, returns the decoded size or -1 if it is corrupt.
+static long lz4_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t cap)
+{
+  const uint8_t *ip = src, *iend = src + size;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  while (ip < iend)
+  {
+    unsigned token = *ip++;
+    size_t len = token >> 4;
+    if (len == 15)
+    {
+      unsigned b;
+      do
+      {
+        if (ip >= iend) return -1;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    if ((len > (size_t)(iend - ip)) || (len > (size_t)(oend - op))) return -1;
+    memcpy(op, ip, len);
+    ip += len;
+    op += len;
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2) return -1;
+    size_t dist = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((dist == 0) || (dist > (size_t)(op - dst))) return -1;
+    len = token & 15;
+    if (len == 15)
+    {
+      unsigned b;
+      do
+      {
+        if (ip >= iend) return -1;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += 4;
+    if (len > (size_t)(oend - op)) return -1;
+    const uint8_t *m = op - dist;
+    while (len--)
+      *op++ = *m++;
+  }
+  return op - dst;
+}
+
+static FILE *listen_once(int port)
+{
+  int one = 1;
+  struct sockaddr_in addr;
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) || listen(s, 1))
+  {
+    fprintf(stderr, "port %d: %s\n", port, strerror(errno));
+    return NULL;
+  }
+  printf("waiting for the dumper on port %d...\n", port);
+  int c = accept(s, NULL, NULL);
+  close(s);
+  if (c < 0)
+    return NULL;
+  int size = 4 << 20;
+  setsockopt(c, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  FILE *f = fdopen(c, "rb");
+  setvbuf(f, NULL, _IOFBF, 1 << 20);
+  return f;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  struct pack_header_t header;
+  const char *dest;
+  FILE *f;
+
+  if ((argc >= 3) && !strcmp(argv[1], "-l"))
+  {
+    f = listen_once(atoi(argv[2]));
+    dest = (argc > 3) ? argv[3] : ".";
+  }
+  else
+  if (argc >= 2)
+  {
+    f = fopen(argv[1], "rb");
+    if (!f)
+      fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+    dest = (argc > 2) ? argv[2] : ".";
+  }
+  else
+  {
+    fprintf(stderr, "usage: %s TITLE_ID.pack [destination]\n       %s -l PORT [destination]\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (!f)
+    return 1;
+
+  double start = now();
+  if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != PACK_MAGIC))
+  {
+    fprintf(stderr, "not a pack stream\n");
+    return 1;
+  }
+
+  // Entries come in the stream ahead of their data, a name created again
+  // later starts over like it would on the USB disk.
+  uint32_t count = 0, capacity = 0;
+  char **paths = NULL;
+  size_t bufsz = 1 << 20, rawsz = 1 << 20;
+  char *buf = malloc(bufsz);
+  uint8_t *raw = malloc(rawsz);
+  uint64_t total = sizeof(header), records = 0, packed = 0, unpacked = 0;
+  int fd = -1;
+  uint32_t fd_id = 0;
+  int ended = 0;
+
+  while (!ended)
+  {
+    struct pack_record_t r;
+    if (fread(&r, sizeof(r), 1, f) != 1)
+      break;
+    if (r.len > bufsz)
+    {
+      bufsz = r.len;
+      buf = realloc(buf, bufsz);
+    }
+    if (fread(buf, 1, r.len, f) != r.len)
+      break;
+    total += sizeof(r) + r.len;
+    records++;
+
+    if (r.codec == CODEC_END)
+    {
+      ended = 1;
+      break;
+    }
+    if (r.codec == CODEC_ENTRY)
+    {
+      if (r.id >= capacity)
+      {
+        capacity = (r.id + 1) * 2;
+        paths = realloc(paths, capacity * sizeof(char *));
+      }
+      if (r.id >= count)
+        count = r.id + 1;
+      paths[r.id] = malloc(strlen(dest) + r.len + 2);
+      int n = sprintf(paths[r.id], "%s/", dest);
+      memcpy(paths[r.id] + n, buf, r.len);
+      paths[r.id][n + r.len] = 0;
+      mkdirs(paths[r.id]);
+      if (r.raw == PACK_DIR)
+        mkdir(paths[r.id], 0777);
+      else
+      {
+        int out = open(paths[r.id], O_WRONLY | O_CREAT | O_TRUNC, 0777);
+        if (out == -1)
+          fprintf(stderr, "%s: %s\n", paths[r.id], strerror(errno));
+        else
+          close(out);
+      }
+      continue;
+    }
+    if (r.id >= count)
+    {
+      fprintf(stderr, "record for unknown entry %u\n", r.id);
+      return 1;
+    }
+
+    const char *data = buf;
+    if (r.codec == CODEC_LZ4)
+    {
+      if (r.raw > rawsz)
+      {
+        rawsz = r.raw;
+        raw = realloc(raw, rawsz);
+      }
+      if (lz4_decompress((uint8_t *)buf, r.len, raw, r.raw) != (long)r.raw)
+      {
+        fprintf(stderr, "corrupt block at 0x%llx\n", (unsigned long long)(total - r.len));
+        return 1;
+      }
+      data = (char *)raw;
+    }
+    if ((fd == -1) || (fd_id != r.id))
+    {
+      if (fd != -1)
+        close(fd);
+      fd = open(paths[r.id], O_WRONLY);
+      fd_id = r.id;
+    }
+    if (fd != -1)
+      pwrite(fd, data, r.raw, r.offset);
+    packed += r.len;
+    unpacked += r.raw;
+  }
+  if (fd != -1)
+    close(fd);
+
+  if (!ended)
+  {
+    fprintf(stderr, "stream ended early, the dump is incomplete\n");
+    return 1;
+  }
+
+  // The index after the end record gives the final sizes, writes that were
+  // seeked past leave holes at the end of a file otherwise.
+  for (uint32_t i = 0; i < count; i++)
+  {
+    struct pack_entry_t e;
+    if (fread(&e, sizeof(e), 1, f) != 1)
+      break;
+    if (e.namelen > bufsz)
+    {
+      bufsz = e.namelen;
+      buf = realloc(buf, bufsz);
+    }
+    fread(buf, 1, e.namelen, f);
+    total += sizeof(e) + e.namelen;
+    if (e.type != PACK_DIR)
+      truncate(paths[i], e.size);
+  }
+  struct pack_header_t trailer;
+  if ((fread(&trailer, sizeof(trailer), 1, f) != 1) || (trailer.magic != PACK_MAGIC) || (trailer.count != count))
+    fprintf(stderr, "bad trailer\n");
+  total += sizeof(trailer);
+  fclose(f);
+
+  double secs = now() - start;
+  if (secs < 0.001) secs = 0.001;
+  printf("%u entries, %llu records, %llu bytes in %.2f s\n", count, (unsigned long long)records, (unsigned long long)total, secs);
+  if (unpacked)
+  {
+    printf("data %llu bytes stored as %llu (%.1f%%), framing %.2f%%\n", (unsigned long long)unpacked, (unsigned long long)packed,
+      packed * 100.0 / unpacked, (total - packed) * 100.0 / total);
+    printf("%.1f MB/s received, %.1f MB/s effective\n", total / secs / 1e6, unpacked / secs / 1e6);
+  }
+  return 0;
+}